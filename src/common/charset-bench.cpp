@@ -0,0 +1,214 @@
+/* HexChat
+ * Copyright (C) 2014 Berke Viktor.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/* Times the charset helpers on IRC-sized lines against what they replaced:
+ *
+ *   charset-bench [lines]
+ *
+ * Every check runs over the same number of pure ASCII, mixed (ASCII with
+ * some UTF-8) and invalid UTF-8 (CP1252 bytes) lines and prints ns per
+ * line and MB/s:
+ *
+ *   is_ascii, is_valid_utf8    the vectorized checks
+ *   g_utf8_validate            the validation text_validate used to do
+ *   cp1252_to_utf8             the table-driven fallback transcoder
+ *   old cp1252->utf8           the ostringstream transcoder it replaced
+ *   iconv cp1252->utf8         a charset::converter, as servers use
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <glib.h>
+#include <boost/utility/string_ref.hpp>
+
+#include "charset_helpers.hpp"
+
+namespace
+{
+	/* the longest line a server will send us */
+	const std::size_t line_length = 510;
+	const std::size_t distinct_lines = 64;
+
+	std::vector<std::string> make_lines(const char * filler)
+	{
+		const std::string ascii = "PRIVMSG #hexchat :the quick brown fox jumps over the lazy dog ";
+		std::vector<std::string> lines;
+		for (std::size_t i = 0; i < distinct_lines; ++i)
+		{
+			std::string line;
+			while (line.size() < line_length)
+			{
+				line += ascii.substr(i % ascii.size());
+				if (filler)
+					line += filler;
+			}
+			line.resize(line_length);
+			/* don't leave a sequence cut in half at the end */
+			while (filler && !charset::is_valid_utf8(line) && charset::is_valid_utf8(filler))
+				line.pop_back();
+			lines.push_back(line);
+		}
+		return lines;
+	}
+
+	/* text.cpp's iso_8859_1_to_utf8 before the lookup table, for comparison */
+	std::string old_iso_8859_1_to_utf8(const boost::string_ref & in)
+	{
+		typedef std::basic_ostringstream<unsigned char> utf8ostringstream;
+		static const unsigned short lowtable[] = /* 74 byte table for 80-a4 */
+		{
+		/* compressed utf-8 table: if the first byte's 0x20 bit is set, it
+		   indicates a 2-byte utf-8 sequence, otherwise prepend a 0xe2. */
+			0x82ac, 0xe281, 0x809a, 0xe692, 0x809e, 0x80a6, 0x80a0, 0x80a1,
+			0xeb86, 0x80b0, 0xe5a0, 0x80b9, 0xe592, 0xe28d, 0xe5bd, 0xe28f,
+			0xe290, 0x8098, 0x8099, 0x809c, 0x809d, 0x80a2, 0x8093, 0x8094,
+			0xeb9c, 0x84a2, 0xe5a1, 0x80ba, 0xe593, 0xe29d, 0xe5be, 0xe5b8,
+			0xe2a0, 0xe2a1, 0xe2a2, 0xe2a3, 0x82ac
+		};
+		auto len = in.size();
+		const unsigned char* text = reinterpret_cast<const unsigned char*>(in.data());
+
+		utf8ostringstream output_stream;
+		std::ostream_iterator<unsigned char, unsigned char> output(output_stream);
+		while (len)
+		{
+			if (G_LIKELY (*text < 0x80))
+			{
+				*output = *text;	/* ascii maps directly */
+			}
+			else if (*text <= 0xa4)	/* 80-a4 use a lookup table */
+			{
+				auto idx = *text - 0x80;
+				if (lowtable[idx] & 0x2000)
+				{
+					*output++ = (lowtable[idx] >> 8) & 0xdf; /* 2 byte utf-8 */
+					*output = lowtable[idx] & 0xff;
+				}
+				else
+				{
+					*output++ = 0xe2;	/* 3 byte utf-8 */
+					*output++ = (lowtable[idx] >> 8) & 0xff;
+					*output = lowtable[idx] & 0xff;
+				}
+			}
+			else if (*text < 0xc0)
+			{
+				*output++ = 0xc2;
+				*output = *text;
+			}
+			else
+			{
+				*output++ = 0xc3;
+				*output = *text - 0x40;
+			}
+			output++;
+			text++;
+			len--;
+		}
+		auto str = output_stream.str();
+		return std::string{ str.cbegin(), str.cend() };
+	}
+
+	volatile std::size_t sink;
+
+	template<class Func>
+	void run(const char * name, const char * input, const std::vector<std::string> & lines, std::size_t count, Func func)
+	{
+		std::size_t bytes = 0;
+		std::size_t result = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			const std::string & line = lines[i % lines.size()];
+			result += func(line);
+			bytes += line.size();
+		}
+		auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		sink = result;
+		std::printf("%-20s %-8s %8.1f ns/line %9.1f MB/s\n", name, input,
+			static_cast<double>(elapsed) / count,
+			elapsed ? bytes * 1000.0 / elapsed : 0.0);
+	}
+}
+
+int main(int argc, char * argv[])
+{
+	std::size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+	if (!count)
+	{
+		std::fprintf(stderr, "usage: %s [lines]\n", argv[0]);
+		return 1;
+	}
+
+	struct input
+	{
+		const char * name;
+		std::vector<std::string> lines;
+	};
+	const input inputs[] = {
+		{ "ascii", make_lines(nullptr) },
+		{ "mixed", make_lines("\xc3\xa9t\xc3\xa9 \xe6\x97\xa5\xe6\x9c\xac ") },
+		{ "invalid", make_lines("\x93quoted\x94 caf\xe9 ") },
+	};
+
+	charset::converter cp1252("UTF-8", "CP1252");
+	if (!cp1252.valid())
+	{
+		std::fprintf(stderr, "no CP1252 converter\n");
+		return 1;
+	}
+	std::string out;
+
+	for (const auto & in : inputs)
+	{
+		run("is_ascii", in.name, in.lines, count, [](const std::string & line)
+		{
+			return static_cast<std::size_t>(charset::is_ascii(line));
+		});
+		run("is_valid_utf8", in.name, in.lines, count, [](const std::string & line)
+		{
+			return static_cast<std::size_t>(charset::is_valid_utf8(line));
+		});
+		run("g_utf8_validate", in.name, in.lines, count, [](const std::string & line)
+		{
+			return static_cast<std::size_t>(g_utf8_validate(line.data(), line.size(), nullptr));
+		});
+		/* sized and returned as a string, the way text_validate uses it */
+		run("cp1252_to_utf8", in.name, in.lines, count, [](const std::string & line)
+		{
+			std::string result(line.size() * 3, '\0');
+			result.resize(charset::cp1252_to_utf8(line, &result[0]));
+			return result.size();
+		});
+		run("old cp1252->utf8", in.name, in.lines, count, [](const std::string & line)
+		{
+			return old_iso_8859_1_to_utf8(line).size();
+		});
+		run("iconv cp1252->utf8", in.name, in.lines, count, [&](const std::string & line)
+		{
+			cp1252.convert(line, out, "?");
+			return out.size();
+		});
+	}
+	return 0;
+}
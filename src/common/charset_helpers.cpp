@@ -16,18 +16,34 @@
 * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
 */
 
-#ifndef WIN32
-#error THIS FILE IS FOR THE WINDOWS BUILD ONLY!
-#endif
-
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#ifdef WIN32
 #include <codecvt>
 #include <locale>
-#include <string>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define CHARSET_USE_AVX2
+#define CHARSET_USE_SSE2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CHARSET_USE_SSE2
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#include <boost/utility/string_ref.hpp>
 
 #include "charset_helpers.hpp"
 
 namespace charset
 {
+#ifdef WIN32
 	std::string narrow(const std::wstring & to_narrow)
 	{
 		std::wstring_convert<std::codecvt_utf8_utf16<wchar_t> > converter;
@@ -39,4 +55,371 @@ namespace charset
 		std::wstring_convert<std::codecvt_utf8_utf16<wchar_t> > converter;
 		return converter.from_bytes(to_widen);
 	}
-}
\ No newline at end of file
+#endif
+
+	namespace
+	{
+#ifdef CHARSET_USE_SSE2
+		std::size_t lowest_bit(unsigned int mask)
+		{
+#ifdef _MSC_VER
+			unsigned long index;
+			_BitScanForward(&index, mask);
+			return index;
+#else
+			return __builtin_ctz(mask);
+#endif
+		}
+#endif
+
+		/* length of the leading run of 7-bit bytes. IRC traffic is mostly
+		   ASCII, so this is where validation and conversion spend their time */
+		std::size_t ascii_prefix(const unsigned char * p, std::size_t len)
+		{
+			std::size_t i = 0;
+#ifdef CHARSET_USE_AVX2
+			for (; i + 32 <= len; i += 32)
+			{
+				auto mask = static_cast<unsigned int>(_mm256_movemask_epi8(
+					_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i))));
+				if (mask)
+					return i + lowest_bit(mask);
+			}
+#endif
+#ifdef CHARSET_USE_SSE2
+			for (; i + 16 <= len; i += 16)
+			{
+				auto mask = static_cast<unsigned int>(_mm_movemask_epi8(
+					_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i))));
+				if (mask)
+					return i + lowest_bit(mask);
+			}
+#else
+			/* portable fallback: a 64-bit word at a time */
+			for (; i + 8 <= len; i += 8)
+			{
+				std::uint64_t w;
+				std::memcpy(&w, p + i, sizeof(w));
+				if (w & 0x8080808080808080ULL)
+					break;
+			}
+#endif
+			while (i < len && p[i] < 0x80)
+				++i;
+			return i;
+		}
+
+		bool continuation(unsigned char c)
+		{
+			return (c & 0xc0) == 0x80;
+		}
+
+		/* length of the well-formed (RFC 3629) sequence at p, or 0 */
+		std::size_t utf8_sequence(const unsigned char * p, std::size_t len)
+		{
+			const unsigned char c = p[0];
+			if (c < 0x80)
+				return 1;
+			if (c < 0xc2)	/* stray continuation or overlong 2-byte lead */
+				return 0;
+			if (c < 0xe0)
+				return len >= 2 && continuation(p[1]) ? 2 : 0;
+			if (c < 0xf0)
+			{
+				if (len < 3 || !continuation(p[2]))
+					return 0;
+				/* no overlongs after E0, no surrogates after ED */
+				const unsigned char lo = c == 0xe0 ? 0xa0 : 0x80;
+				const unsigned char hi = c == 0xed ? 0x9f : 0xbf;
+				return p[1] >= lo && p[1] <= hi ? 3 : 0;
+			}
+			if (c < 0xf5)
+			{
+				if (len < 4 || !continuation(p[2]) || !continuation(p[3]))
+					return 0;
+				/* no overlongs after F0, nothing above U+10FFFF after F4 */
+				const unsigned char lo = c == 0xf0 ? 0x90 : 0x80;
+				const unsigned char hi = c == 0xf4 ? 0x8f : 0xbf;
+				return p[1] >= lo && p[1] <= hi ? 4 : 0;
+			}
+			return 0;
+		}
+	}
+
+	bool is_ascii(const boost::string_ref & text)
+	{
+		return ascii_prefix(reinterpret_cast<const unsigned char*>(text.data()), text.size()) == text.size();
+	}
+
+	bool is_valid_utf8(const boost::string_ref & text)
+	{
+		const unsigned char * p = reinterpret_cast<const unsigned char*>(text.data());
+		const std::size_t len = text.size();
+		std::size_t i = ascii_prefix(p, len);
+		while (i < len)
+		{
+			/* stay scalar through non-ASCII text, vectorize again on ASCII */
+			if (p[i] < 0x80)
+			{
+				i += ascii_prefix(p + i, len - i);
+				continue;
+			}
+			auto seq = utf8_sequence(p + i, len - i);
+			if (!seq)
+				return false;
+			i += seq;
+		}
+		return true;
+	}
+
+	namespace
+	{
+		struct utf8_encoding
+		{
+			unsigned char len;
+			unsigned char bytes[3];
+		};
+
+		const std::array<utf8_encoding, 128> & high_half_table()
+		{
+			static const unsigned short lowtable[] = /* 74 byte table for 80-a4 */
+			{
+			/* compressed utf-8 table: if the first byte's 0x20 bit is set, it
+			   indicates a 2-byte utf-8 sequence, otherwise prepend a 0xe2. */
+				0x82ac, /* 80 Euro. CP1252 from here on... */
+				0xe281, /* 81 NA */
+				0x809a, /* 82 */
+				0xe692, /* 83 */
+				0x809e, /* 84 */
+				0x80a6, /* 85 */
+				0x80a0, /* 86 */
+				0x80a1, /* 87 */
+				0xeb86, /* 88 */
+				0x80b0, /* 89 */
+				0xe5a0, /* 8a */
+				0x80b9, /* 8b */
+				0xe592, /* 8c */
+				0xe28d, /* 8d NA */
+				0xe5bd, /* 8e */
+				0xe28f, /* 8f NA */
+				0xe290, /* 90 NA */
+				0x8098, /* 91 */
+				0x8099, /* 92 */
+				0x809c, /* 93 */
+				0x809d, /* 94 */
+				0x80a2, /* 95 */
+				0x8093, /* 96 */
+				0x8094, /* 97 */
+				0xeb9c, /* 98 */
+				0x84a2, /* 99 */
+				0xe5a1, /* 9a */
+				0x80ba, /* 9b */
+				0xe593, /* 9c */
+				0xe29d, /* 9d NA */
+				0xe5be, /* 9e */
+				0xe5b8, /* 9f */
+				0xe2a0, /* a0 */
+				0xe2a1, /* a1 */
+				0xe2a2, /* a2 */
+				0xe2a3, /* a3 */
+				0x82ac  /* a4 ISO-8859-15 Euro. */
+			};
+
+			static std::array<utf8_encoding, 128> table;
+			static bool built = false;
+			if (built)
+				return table;
+
+			for (unsigned int c = 0x80; c <= 0xff; ++c)
+			{
+				utf8_encoding & seq = table[c - 0x80];
+				if (c <= 0xa4)	/* 80-a4 use the compressed table */
+				{
+					auto entry = lowtable[c - 0x80];
+					if (entry & 0x2000)
+					{
+						seq.len = 2;
+						seq.bytes[0] = (entry >> 8) & 0xdf;
+						seq.bytes[1] = entry & 0xff;
+					}
+					else
+					{
+						seq.len = 3;
+						seq.bytes[0] = 0xe2;
+						seq.bytes[1] = (entry >> 8) & 0xff;
+						seq.bytes[2] = entry & 0xff;
+					}
+				}
+				else if (c < 0xc0)
+				{
+					seq.len = 2;
+					seq.bytes[0] = 0xc2;
+					seq.bytes[1] = c;
+				}
+				else
+				{
+					seq.len = 2;
+					seq.bytes[0] = 0xc3;
+					seq.bytes[1] = c - 0x40;
+				}
+			}
+			built = true;
+			return table;
+		}
+	}
+
+	/* converts a CP1252/ISO-8859-1(5) hybrid to UTF-8                           */
+	/* Features: 1. It never fails, all 00-FF chars are converted to valid UTF-8 */
+	/*           2. Uses CP1252 in the range 80-9f because ISO doesn't have any- */
+	/*              thing useful in this range and it helps us receive from mIRC */
+	/*           3. The five undefined chars in CP1252 80-9f are replaced with   */
+	/*              ISO-8859-15 control codes.                                   */
+	/*           4. Handles 0xa4 as a Euro symbol ala ISO-8859-15.               */
+	/*           5. Uses ISO-8859-1 (which matches CP1252) for everything else.  */
+	/*           6. This routine measured 3x faster than g_convert :)            */
+	/*           7. Table driven: each high byte expands to a precomputed        */
+	/*              sequence, written into a buffer the caller sized to 3x.     */
+	std::size_t cp1252_to_utf8(const boost::string_ref & in, char * out)
+	{
+		const auto & table = high_half_table();
+		auto text = reinterpret_cast<const unsigned char*>(in.data());
+		auto end = text + in.size();
+		auto output = reinterpret_cast<unsigned char*>(out);
+
+		for (; text != end; ++text)
+		{
+			if (G_LIKELY (*text < 0x80))
+			{
+				*output++ = *text;	/* ascii maps directly */
+				continue;
+			}
+			const utf8_encoding & seq = table[*text - 0x80];
+			output[0] = seq.bytes[0];
+			output[1] = seq.bytes[1];
+			output[2] = seq.bytes[2];	/* harmless when len is 2, room is reserved */
+			output += seq.len;
+		}
+		return output - reinterpret_cast<unsigned char*>(out);
+	}
+
+	bool ascii_compatible(const char * encoding)
+	{
+		static const char * const exceptions[] = {
+			"ISO-2022", "ISO2022", "CSISO2022", "UTF-7", "UTF7", "HZ",
+			"UTF-16", "UTF16", "UTF-32", "UTF32", "UCS-2", "UCS2", "UCS-4", "UCS4"
+		};
+		if (!encoding)
+			return false;
+		for (const char * prefix : exceptions)
+			if (!g_ascii_strncasecmp(encoding, prefix, std::strlen(prefix)))
+				return false;
+		return true;
+	}
+
+	bool is_utf8(const char * encoding)
+	{
+		return encoding && (!g_ascii_strcasecmp(encoding, "UTF-8") ||
+			!g_ascii_strcasecmp(encoding, "UTF8"));
+	}
+
+	converter::converter()
+		:cd_(reinterpret_cast<GIConv>(-1)), from_utf8_()
+	{}
+
+	converter::converter(const char * to, const char * from)
+		:cd_(g_iconv_open(to, from)), from_utf8_(is_utf8(from))
+	{}
+
+	converter::~converter()
+	{
+		if (valid())
+			g_iconv_close(cd_);
+	}
+
+	converter::converter(converter && other)
+		:cd_(other.cd_), from_utf8_(other.from_utf8_)
+	{
+		other.cd_ = reinterpret_cast<GIConv>(-1);
+	}
+
+	converter& converter::operator=(converter && other)
+	{
+		if (this != &other)
+		{
+			if (valid())
+				g_iconv_close(cd_);
+			cd_ = other.cd_;
+			from_utf8_ = other.from_utf8_;
+			other.cd_ = reinterpret_cast<GIConv>(-1);
+		}
+		return *this;
+	}
+
+	bool converter::valid() const
+	{
+		return cd_ != reinterpret_cast<GIConv>(-1);
+	}
+
+	bool converter::convert(const boost::string_ref & in, std::string & out, const char * substitute)
+	{
+		if (!valid())
+			return false;
+
+		/* forget any shift state left over from a failed line */
+		g_iconv(cd_, nullptr, nullptr, nullptr, nullptr);
+
+		gchar * inbuf = const_cast<gchar*>(in.data());
+		gsize inleft = in.size();
+		std::string::size_type used = 0;
+		bool flushing = false;
+		out.resize(in.size() + 16);
+
+		for (;;)
+		{
+			gchar * outbuf = &out[used];
+			gsize outleft = out.size() - used;
+			/* the final call with no input writes out anything the converter
+			   still holds back, e.g. a CP1255 base letter awaiting its points */
+			gsize res = flushing
+				? g_iconv(cd_, nullptr, nullptr, &outbuf, &outleft)
+				: g_iconv(cd_, &inbuf, &inleft, &outbuf, &outleft);
+			used = out.size() - outleft;
+			if (res != static_cast<gsize>(-1))
+			{
+				if (flushing)
+					break;
+				flushing = true;
+				continue;
+			}
+
+			switch (errno)
+			{
+			case E2BIG:
+				out.resize(out.size() * 2);
+				break;
+			case EILSEQ:
+			case EINVAL:	/* truncated sequence at the end of the line */
+			{
+				if (!substitute)
+					return false;
+				/* from UTF-8 the bad input is a whole character the target
+				   can't represent; anything else is skipped byte by byte */
+				gsize skip = 1;
+				if (from_utf8_)
+					skip = std::min<gsize>(inleft, g_utf8_skip[static_cast<unsigned char>(*inbuf)]);
+				inbuf += skip;
+				inleft -= skip;
+				out.resize(used);
+				out += substitute;
+				used = out.size();
+				out.resize(used + inleft + 16);
+				break;
+			}
+			default:
+				return false;
+			}
+		}
+		out.resize(used);
+		return true;
+	}
+}
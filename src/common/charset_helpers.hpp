@@ -19,13 +19,52 @@
 #ifndef HEXCHAT_CHARSET_HELPERS_HPP
 #define HEXCHAT_CHARSET_HELPERS_HPP
 
-#ifdef WIN32
 #include <string>
+#include <glib.h>
+#include <boost/utility/string_ref_fwd.hpp>
 
 namespace charset{
+#ifdef WIN32
 	std::string narrow(const std::wstring &);
 	std::wstring widen(const std::string &);
-}
 #endif
 
+	/* true if every byte is 7-bit; uses SSE2/AVX2 where the build allows */
+	bool is_ascii(const boost::string_ref &);
+	/* strict RFC 3629 check: no overlongs, surrogates or code points past
+	   U+10FFFF. ASCII runs are skipped a vector at a time. */
+	bool is_valid_utf8(const boost::string_ref &);
+	/* the CP1252/ISO-8859-1(5) hybrid hexchat falls back to for text that
+	   isn't UTF-8; |out| must have room for 3 * in.size() bytes. Returns
+	   the bytes written. */
+	std::size_t cp1252_to_utf8(const boost::string_ref & in, char * out);
+	/* true if pure ASCII text is left untouched by the encoding, i.e. it
+	   is neither a 7-bit stateful one (ISO-2022-*, UTF-7, HZ) nor UTF-16/32 */
+	bool ascii_compatible(const char * encoding);
+	bool is_utf8(const char * encoding);
+
+	/* A persistent iconv descriptor. Opening one is expensive compared to
+	   converting a single IRC line, so servers keep theirs for as long as
+	   the encoding doesn't change. */
+	class converter
+	{
+		GIConv cd_;
+		bool from_utf8_;
+	public:
+		converter();
+		converter(const char * to, const char * from);
+		~converter();
+		converter(converter &&);
+		converter& operator=(converter &&);
+		converter(const converter&) = delete;
+		converter& operator=(const converter&) = delete;
+
+		bool valid() const;
+		/* Converts |in| in a single pass. Every illegal or unrepresentable
+		   sequence is replaced with |substitute|; with a null substitute the
+		   conversion fails instead. Returns false if nothing was converted. */
+		bool convert(const boost::string_ref & in, std::string & out, const char * substitute);
+	};
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,135 @@
+/* HexChat
+ * Copyright (C) 1998-2010 Peter Zelezny.
+ * Copyright (C) 2009-2013 Berke Viktor.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#ifndef HEXCHAT_COMMAND_TABLE_HPP
+#define HEXCHAT_COMMAND_TABLE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include <boost/utility/string_ref.hpp>
+
+/* A perfect hash over a fixed array of entries with a |name| member,
+   gperf style: the seed is searched once, on construction, until no two
+   names share a slot. A lookup is then one hash of the name and one
+   compare, however long the table. Names are case insensitive.
+
+   Like gperf's key positions, the hash looks only at the length, the
+   first four characters and the last one, so it costs the same for any
+   name; construction throws if two names agree on all of those. */
+template<class Entry>
+class command_table
+{
+	struct slot_entry
+	{
+		const Entry *entry;
+		std::size_t len;
+	};
+
+	const Entry *begin_;
+	const Entry *end_;
+	std::vector<slot_entry> slots_;
+	unsigned int shift_;
+	std::uint32_t seed_;
+
+	/* g_ascii_toupper, but inline and without a branch: this runs for
+	   every message */
+	static std::uint8_t upper (char c)
+	{
+		const std::uint8_t u = static_cast<std::uint8_t>(c);
+		return u - ((static_cast<std::uint8_t>(u - 'a') < 26) << 5);
+	}
+
+	std::size_t slot (const boost::string_ref & name, std::uint32_t seed) const
+	{
+		std::uint32_t key = static_cast<std::uint32_t>(name.size ());
+		switch (name.size ())
+		{
+		default:
+			key ^= upper (name[3]) << 24;
+			/* fall through */
+		case 3:
+			key ^= upper (name[2]) << 16;
+			/* fall through */
+		case 2:
+			key ^= upper (name[1]) << 8 ^ upper (name[name.size () - 1]) << 12;
+			/* fall through */
+		case 1:
+			key ^= upper (name[0]) << 4;
+			/* fall through */
+		case 0:
+			break;
+		}
+		return static_cast<std::size_t>(((key ^ seed) * 0x9e3779b1u) >> shift_);
+	}
+
+	bool try_seed (std::uint32_t seed)
+	{
+		slot_entry empty = { nullptr, 0 };
+		std::fill (slots_.begin (), slots_.end (), empty);
+		for (auto entry = begin_; entry != end_; ++entry)
+		{
+			const boost::string_ref name (entry->name);
+			auto & s = slots_[slot (name, seed)];
+			if (s.entry)
+				return false;
+			s.entry = entry;
+			s.len = name.size ();
+		}
+		return true;
+	}
+
+public:
+	command_table (const Entry *begin, const Entry *end)
+		:begin_(begin), end_(end), shift_(), seed_()
+	{
+		/* start at four slots per entry; a bigger table finds a seed sooner */
+		unsigned int bits = 1;
+		while ((std::size_t(1) << bits) < 4 * static_cast<std::size_t>(end - begin))
+			++bits;
+		for (; bits <= 16; ++bits)
+		{
+			slots_.resize (std::size_t(1) << bits);
+			shift_ = 32 - bits;
+			for (seed_ = 0; seed_ < 1000; ++seed_)
+				if (try_seed (seed_))
+					return;
+		}
+		throw std::logic_error ("command_table: two names hash the same");
+	}
+
+	/* the entry called |name|, or nullptr */
+	const Entry *find (const boost::string_ref & name) const
+	{
+		const auto & s = slots_[slot (name, seed_)];
+		if (!s.entry || s.len != name.size ())
+			return nullptr;
+		/* servers send commands upper case, as they're registered */
+		if (std::memcmp (s.entry->name, name.data (), s.len) == 0)
+			return s.entry;
+		for (std::size_t i = 0; i < s.len; ++i)
+			if (upper (s.entry->name[i]) != upper (name[i]))
+				return nullptr;
+		return s.entry;
+	}
+};
+
+#endif
@@ -377,34 +377,12 @@ dcc_chat_line(::dcc::DCC *dcc, char *line)
 	char *word[PDIWORDS];
 	char *po;
 	int ret, i;
-	size_t len;
-	gsize utf_len;
 	char portbuf[32];
 	message_tags_data no_tags = message_tags_data();
 
-	len = strlen(line);
-	if (dcc->serv->using_cp1255)
-		len++;	/* include the NUL terminator */
-
-	glib_string utf;
-	if (dcc->serv->using_irc) /* using "IRC" encoding (CP1252/UTF-8 hybrid) */
-		utf = nullptr;
-	else if (dcc->serv->encoding)     /* system */
-		utf.reset(g_locale_to_utf8(line, len, NULL, &utf_len, NULL));
-	else
-		utf.reset(g_convert(line, len, "UTF-8", dcc->serv->encoding->c_str(), 0, &utf_len, 0));
-
-	if (utf)
-	{
-		line = utf.get();
-		len = utf_len;
-	}
-
-	if (dcc->serv->using_cp1255 && len > 0)
-		len--;
-
-	/* we really need valid UTF-8 now */
-	auto conv = text_validate(boost::string_ref{ line, len });
+	/* same charset as the server we got the offer from */
+	auto conv = dcc->serv->decode_line(line);
+	line = &conv[0];
 
 	sess = find_dialog(*(dcc->serv), dcc->nick);
 	if (!sess)
@@ -434,7 +412,7 @@ dcc_chat_line(::dcc::DCC *dcc, char *line)
 		return 0;
 	}
 
-	url_check_line(line, len);
+	url_check_line(line, conv.size());
 
 	if (line[0] == 1 && !g_ascii_strncasecmp(line + 1, "ACTION", 6))
 	{
@@ -2024,9 +2002,9 @@ dcc_write_chat (char *nick, char *text)
 		dcc = ::dcc::find_dcc(nick, "", ::dcc::DCC::dcc_type::TYPE_CHATSEND);
 	if (dcc && dcc->dccstat == STAT_ACTIVE)
 	{
-		len = strlen (text);
-		tcp_send_real (NULL, dcc->sok, dcc->serv->encoding->c_str(), dcc->serv->using_irc,
-							text, len, nullptr);
+		auto wire = dcc->serv->encode_line (text);
+		len = static_cast<int>(wire.size ());
+		send (dcc->sok, wire.data (), wire.size (), 0);
 		send (dcc->sok, "\n", 1, 0);
 		dcc->size += len;
 		::fe::fe_dcc_update (dcc);
@@ -0,0 +1,185 @@
+/* HexChat
+ * Copyright (C) 1998-2010 Peter Zelezny.
+ * Copyright (C) 2009-2013 Berke Viktor.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/* Times finding the handler for a named server message:
+ *
+ *   dispatch-bench [lookups]
+ *
+ * command_table, as process_named_msg uses it, against the WORDL switches
+ * on length and first four characters it replaced, over a stream of
+ * commands weighted like a busy channel's (mostly PRIVMSG, some JOIN,
+ * PART, QUIT, MODE, NOTICE, and an unknown one now and then). Prints ns
+ * per lookup for each.
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <vector>
+
+#include "command_table.hpp"
+
+namespace
+{
+	struct named_command
+	{
+		const char *name;
+		int id;
+	};
+
+	/* the names proto-irc.cpp registers in named_commands */
+	const named_command named_commands[] =
+	{
+		{ "ACCOUNT", 1 },
+		{ "AWAY", 2 },
+		{ "CAP", 3 },
+		{ "CHGHOST", 4 },
+		{ "INVITE", 5 },
+		{ "JOIN", 6 },
+		{ "KICK", 7 },
+		{ "KILL", 8 },
+		{ "MODE", 9 },
+		{ "NICK", 10 },
+		{ "NOTICE", 11 },
+		{ "PART", 12 },
+		{ "PONG", 13 },
+		{ "PRIVMSG", 14 },
+		{ "QUIT", 15 },
+		{ "TOPIC", 16 },
+		{ "WALLOPS", 17 },
+	};
+
+	std::uint32_t wordl(std::uint8_t c0, std::uint8_t c1, std::uint8_t c2, std::uint8_t c3)
+	{
+		return static_cast<std::uint32_t>(c0 | (c1 << 8) | (c2 << 16) | (c3 << 24));
+	}
+#define WORDL(c0, c1, c2, c3) (std::uint32_t)(c0 | (c1 << 8) | (c2 << 16) | (c3 << 24))
+
+	/* process_named_msg's dispatch before command_table */
+	int old_dispatch(const char *type)
+	{
+		int len = std::strlen(type);
+		std::uint32_t t = wordl((std::uint8_t)type[0], (std::uint8_t)type[1], (std::uint8_t)type[2], (std::uint8_t)type[3]);
+		if (len == 4)
+		{
+			switch (t)
+			{
+			case WORDL('J','O','I','N'): return 6;
+			case WORDL('K','I','C','K'): return 7;
+			case WORDL('K','I','L','L'): return 8;
+			case WORDL('M','O','D','E'): return 9;
+			case WORDL('N','I','C','K'): return 10;
+			case WORDL('P','A','R','T'): return 12;
+			case WORDL('P','O','N','G'): return 13;
+			case WORDL('Q','U','I','T'): return 15;
+			case WORDL('A','W','A','Y'): return 2;
+			}
+		}
+		else if (len >= 5)
+		{
+			switch (t)
+			{
+			case WORDL('A','C','C','O'): return 1;
+			case WORDL('I','N','V','I'): return 5;
+			case WORDL('N','O','T','I'): return 11;
+			case WORDL('P','R','I','V'): return 14;
+			case WORDL('T','O','P','I'): return 16;
+			case WORDL('W','A','L','L'): return 17;
+			}
+		}
+		else if (len == 3)
+		{
+			switch (t)
+			{
+			case WORDL('C','A','P','\0'): return 3;
+			}
+		}
+		return 0;
+	}
+
+	volatile int sink;
+
+	template<class Func>
+	void run(const char * name, const std::vector<const char *> & stream, std::size_t count, Func func)
+	{
+		int result = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (std::size_t i = 0; i < count; ++i)
+			result += func(stream[i % stream.size()]);
+		auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		sink = result;
+		std::printf("%-14s %6.2f ns/lookup\n", name, static_cast<double>(elapsed) / count);
+	}
+}
+
+int main(int argc, char * argv[])
+{
+	std::size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10000000;
+	if (!count)
+	{
+		std::fprintf(stderr, "usage: %s [lookups]\n", argv[0]);
+		return 1;
+	}
+
+	const struct
+	{
+		const char * name;
+		int weight;
+	} mix[] = {
+		{ "PRIVMSG", 70 }, { "JOIN", 8 }, { "PART", 5 }, { "QUIT", 6 },
+		{ "MODE", 3 }, { "NOTICE", 3 }, { "NICK", 2 }, { "AWAY", 1 },
+		{ "ACCOUNT", 1 }, { "FOO", 1 },
+	};
+	std::vector<const char *> stream;
+	for (const auto & m : mix)
+		for (int i = 0; i < m.weight; ++i)
+			stream.push_back(m.name);
+	/* a fixed shuffle, so both runs see the same order */
+	std::uint32_t state = 12345;
+	for (std::size_t i = stream.size() - 1; i > 0; --i)
+	{
+		state = state * 1103515245u + 12345u;
+		std::swap(stream[i], stream[(state >> 16) % (i + 1)]);
+	}
+
+	const command_table<named_command> table(std::begin(named_commands), std::end(named_commands));
+	for (auto name : stream)
+	{
+		auto entry = table.find(name);
+		if ((entry ? entry->id : 0) != old_dispatch(name))
+		{
+			std::fprintf(stderr, "%s: the two dispatchers disagree\n", name);
+			return 1;
+		}
+	}
+
+	run("command_table", stream, count, [&table](const char * name)
+	{
+		auto entry = table.find(name);
+		return entry ? entry->id : 0;
+	});
+	run("old switch", stream, count, [](const char * name)
+	{
+		return old_dispatch(name);
+	});
+	return 0;
+}
@@ -29,6 +29,7 @@
 #include <ctime>
 #include <chrono>
 #include <new>
+#include <unordered_set>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <boost/utility/string_ref.hpp>
@@ -81,6 +82,7 @@ GSList *command_list = 0;
 GSList *ctcp_list = 0;
 GSList *replace_list = 0;
 GSList *sess_list = 0;
+static std::unordered_set<session *> sess_set;	/* sess_list again, for is_session */
 GSList *dcc_list = 0;
 GSList *usermenu_list = 0;
 GSList *urlhandler_list = 0;
@@ -101,7 +103,9 @@ GSList *tabmenu_list = 0;
  * beginning of one of the lists.  The aim is to be able to switch to the
  * session with the most important/recent activity.
  */
-GList *sess_list_by_lastact[5] = {nullptr, nullptr, nullptr, nullptr, nullptr};
+/* one list per LACT_ priority, most recently active first; the sessions
+   link themselves in through lastact_prev and lastact_next */
+static session *sess_list_by_lastact[5] = {nullptr, nullptr, nullptr, nullptr, nullptr};
 
 
 static std::atomic_bool in_hexchat_exit = { false };
@@ -135,6 +139,35 @@ int RAND_INT(int n)
 	return dist(twstr);
 }
 
+static void
+lastact_unlink (session &sess)
+{
+	if (sess.lastact_idx == LACT_NONE)
+		return;
+
+	if (sess.lastact_prev)
+		sess.lastact_prev->lastact_next = sess.lastact_next;
+	else
+		sess_list_by_lastact[sess.lastact_idx] = sess.lastact_next;
+	if (sess.lastact_next)
+		sess.lastact_next->lastact_prev = sess.lastact_prev;
+
+	sess.lastact_prev = nullptr;
+	sess.lastact_next = nullptr;
+	sess.lastact_idx = LACT_NONE;
+}
+
+static void
+lastact_push (session &sess, int idx)
+{
+	sess.lastact_idx = idx;
+	sess.lastact_prev = nullptr;
+	sess.lastact_next = sess_list_by_lastact[idx];
+	if (sess.lastact_next)
+		sess.lastact_next->lastact_prev = &sess;
+	sess_list_by_lastact[idx] = &sess;
+}
+
 /*
  * Update the priority queue of the "interesting sessions"
  * (sess_list_by_lastact).
@@ -155,18 +188,15 @@ lastact_update(session *sess)
 
 	/* If already first at the right position, just return */
 	if (oldidx == newidx &&
-		 (newidx == LACT_NONE || g_list_index(sess_list_by_lastact[newidx], sess) == 0))
+		 (newidx == LACT_NONE || sess_list_by_lastact[newidx] == sess))
 		return;
 
 	/* Remove from the old position */
-	if (oldidx != LACT_NONE)
-		sess_list_by_lastact[oldidx] = g_list_remove(sess_list_by_lastact[oldidx], sess);
+	lastact_unlink (*sess);
 
 	/* Add at the new position */
-	sess->lastact_idx = newidx;
 	if (newidx != LACT_NONE)
-		sess_list_by_lastact[newidx] = g_list_prepend(sess_list_by_lastact[newidx], sess);
-	return;
+		lastact_push (*sess, newidx);
 }
 
 /*
@@ -180,71 +210,106 @@ lastact_update(session *sess)
 session *
 lastact_getfirst(int (*filter) (session *sess))
 {
-	session *sess = nullptr;
-
 	/* 5 is the number of priority classes LACT_ */
-	for (int i = 0; i < 5 && !sess; i++)
+	for (int i = 0; i < 5; i++)
 	{
-		auto curitem = sess_list_by_lastact[i];
-		while (curitem && !sess)
+		for (auto sess = sess_list_by_lastact[i]; sess; sess = sess->lastact_next)
 		{
-			sess = static_cast<session*>(g_list_nth_data(curitem, 0));
-			if (!sess || (filter && !filter(sess)))
-			{
-				sess = nullptr;
-				curitem = g_list_next(curitem);
-			}
-		}
-
-		if (sess)
-		{
-			sess_list_by_lastact[i] = g_list_remove(sess_list_by_lastact[i], sess);
-			sess->lastact_idx = LACT_NONE;
+			if (filter && !filter(sess))
+				continue;
+			lastact_unlink (*sess);
+			return sess;
 		}
 	}
-	
-	return sess;
+
+	return nullptr;
 }
 
 bool
 is_session (session * sess)
 {
-	return g_slist_find(sess_list, sess) != nullptr;
+	return sess_set.count (sess) != 0;
 }
 
-session * find_dialog(const server &serv, const boost::string_ref &nick)
+namespace
 {
-	GSList *list = sess_list;
-	session *sess;
+	typedef std::unordered_map<boost::string_ref, session *, string_ref_hash> session_index_map;
 
-	while (list)
+	/* the index of its server a session of this type is filed in, if any */
+	session_index_map *
+		session_index_for (session &sess)
 	{
-		sess = static_cast<session*>(list->data);
-		if (sess->server == &serv && sess->type == session::SESS_DIALOG)
+		switch (sess.type)
 		{
-			if (!serv.compare (nick, sess->channel))
-				return (sess);
+		case session::SESS_CHANNEL:
+			return &sess.server->channels;
+		case session::SESS_DIALOG:
+			return &sess.server->dialogs;
+		default:
+			return nullptr;
 		}
-		list = list->next;
 	}
-	return nullptr;
-}
 
-session *find_channel(const server &serv, const boost::string_ref &chan)
+	session *
+		session_index_find (const server &serv, const session_index_map &index, const boost::string_ref &name)
+	{
+		casemapped_name key (serv.casemap, name);
+		auto found = index.find (key.get ());
+		if (found != index.end ())
+			return found->second;
+		return nullptr;
+	}
+} // end anonymous namespace
+
+/* takes |sess| out of its server's channel or dialog index */
+void
+session_unindex (session &sess)
 {
-	session *sess;
-	GSList *list = sess_list;
-	while (list)
+	auto index = session_index_for (sess);
+	if (!index || sess.channel_key.empty ())
+		return;
+
+	auto found = index->find (sess.channel_key);
+	if (found != index->end () && found->second == &sess)
 	{
-		sess = static_cast<session*>(list->data);
-		if ((&serv == sess->server) && sess->type == session::SESS_CHANNEL)
+		index->erase (found);
+		/* a second tab of the same name takes over */
+		for (auto list = sess_list; list; list = g_slist_next (list))
 		{
-			if (!serv.compare(chan, sess->channel))
-				return sess;
+			auto other = static_cast<session *>(list->data);
+			if (other != &sess && other->server == sess.server && other->type == sess.type
+				 && other->channel_key == sess.channel_key)
+			{
+				index->emplace (other->channel_key, other);
+				break;
+			}
 		}
-		list = list->next;
 	}
-	return nullptr;
+	sess.channel_key.clear ();
+}
+
+/* files |sess| under its current name; call whenever sess->channel changes */
+void
+session_index (session &sess)
+{
+	session_unindex (sess);
+	auto index = session_index_for (sess);
+	if (!index || !sess.channel[0])
+		return;
+
+	sess.channel_key = casemapped_name (sess.server->casemap, sess.channel).str ();
+	/* the first tab of a name keeps it */
+	index->emplace (sess.channel_key, &sess);
+}
+
+session * find_dialog(const server &serv, const boost::string_ref &nick)
+{
+	return session_index_find (serv, serv.dialogs, nick);
+}
+
+session *find_channel(const server &serv, const boost::string_ref &chan)
+{
+	return session_index_find (serv, serv.channels, chan);
 }
 
 static void
@@ -467,6 +532,9 @@ session::session(struct server *serv, const char *from, ::session::session_type
 	text_strip(SET_DEFAULT),
 
 	lastact_idx(LACT_NONE),
+	lastact_prev(),
+	lastact_next(),
+	usertree_sort(-1),
 	me(nullptr),
 	channel(),
 	waitchannel(),
@@ -490,6 +558,7 @@ session::session(struct server *serv, const char *from, ::session::session_type
 	ignore_mode(),
 	ignore_names(),
 	end_of_names(),
+	names_loading(),
 	doing_who(),
 	done_away_check(),
 	lastlog_flags()
@@ -507,6 +576,8 @@ session_new (server *serv, const char *from, int type, int focus)
 	session *sess = new session(serv, from, type);
 
 	sess_list = g_slist_prepend (sess_list, sess);
+	sess_set.insert (sess);
+	session_index (*sess);
 
 	fe_new_window (sess, focus);
 
@@ -637,7 +708,6 @@ session_free (session *killsess)
 	server *killserv = killsess->server;
 	session *sess;
 	GSList *list;
-	int oldidx;
 
 	plugin_emit_dummy_print (killsess, "Close Context");
 
@@ -669,11 +739,11 @@ session_free (session *killsess)
 	if (!killserv->server_session)
 		killserv->server_session = killserv->front_session;
 
+	session_unindex (*killsess);
 	sess_list = g_slist_remove (sess_list, killsess);
+	sess_set.erase (killsess);
 
-	oldidx = killsess->lastact_idx;
-	if (oldidx != LACT_NONE)
-		sess_list_by_lastact[oldidx] = g_list_remove(sess_list_by_lastact[oldidx], killsess);
+	lastact_unlink (*killsess);
 
 	log_close (*killsess);
 	scrollback_close (*killsess);
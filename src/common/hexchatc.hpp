@@ -49,13 +49,14 @@ extern GSList *dcc_list;
 extern GSList *usermenu_list;
 extern GSList *urlhandler_list;
 extern GSList *tabmenu_list;
-extern GList *sess_list_by_lastact[];
 
 session * find_channel(const server &serv, const boost::string_ref &chan);
 session * find_dialog(const server &serv, const boost::string_ref &nick);
 void lastact_update (session * sess);
 session * lastact_getfirst (int (*filter) (session *sess));
 bool is_session (session * sess);
+void session_index (session &sess);
+void session_unindex (session &sess);
 void session_free (session *killsess);
 void lag_check (void);
 void hexchat_exit (void);
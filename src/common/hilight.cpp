@@ -0,0 +1,220 @@
+/* HexChat
+ * Copyright (C) 1998-2010 Peter Zelezny.
+ * Copyright (C) 2009-2013 Berke Viktor.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include <algorithm>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <glib.h>
+#include <boost/utility/string_ref.hpp>
+
+#include "hilight.hpp"
+#include "util.hpp"
+
+namespace
+{
+	std::size_t char_len(const char *p, const char *end)
+	{
+		std::size_t len = g_utf8_skip[static_cast<unsigned char>(*p)];
+		return std::min<std::size_t>(len, end - p);
+	}
+
+	/* byte length of the character at |p| if it can be part of a word,
+	   otherwise 0: letters, digits and the RFC 1459 <special>s */
+	std::size_t word_char(const char *p, const char *end)
+	{
+		auto c = static_cast<unsigned char>(*p);
+		if (c < 0x80)
+		{
+			if (g_ascii_isalnum(c))
+				return 1;
+			switch (c)
+			{
+			case '-': case '[': case ']': case '\\':
+			case '`': case '^': case '{': case '}':
+			case '_': case '|':
+				return 1;
+			}
+			return 0;
+		}
+		auto uc = g_utf8_get_char_validated(p, end - p);
+		if (uc == static_cast<gunichar>(-1) || uc == static_cast<gunichar>(-2)
+			|| !g_unichar_isalpha(uc))
+			return 0;
+		return char_len(p, end);
+	}
+
+	bool is_word(const std::string & text)
+	{
+		const char *p = text.data(), *end = p + text.size();
+		while (p < end)
+		{
+			auto len = word_char(p, end);
+			if (!len)
+				return false;
+			p += len;
+		}
+		return true;
+	}
+}
+
+bool
+mask_list::update(const boost::string_ref & masks)
+{
+	if (masks == boost::string_ref(source_))
+		return false;
+	source_ = masks.to_string();
+	masks_.clear();
+
+	std::size_t start = 0;
+	for (;;)
+	{
+		auto stop = source_.find_first_of(" ,", start);
+		auto len = (stop == std::string::npos ? source_.size() : stop) - start;
+		if (len)
+			masks_.emplace_back(source_, start, len);
+		if (stop == std::string::npos)
+			break;
+		start = stop + 1;
+	}
+	return true;
+}
+
+bool
+mask_list::match(const char *word) const
+{
+	for (const auto & mask : masks_)
+		if (::match(mask.c_str(), word))
+			return true;
+	return false;
+}
+
+hilight_matcher::hilight_matcher()
+	:trie_(1)
+{
+	trie_[0].terminal = false;
+}
+
+void
+hilight_matcher::update(const boost::string_ref & nick, const boost::string_ref & masks)
+{
+	bool changed = nick_masks_.update(nick);
+	changed = extra_masks_.update(masks) || changed;
+	if (!changed)
+		return;
+
+	trie_.assign(1, node());
+	trie_[0].terminal = false;
+	wildcards_.clear();
+	compile(nick_masks_);
+	compile(extra_masks_);
+}
+
+void
+hilight_matcher::compile(const mask_list & masks)
+{
+	for (const auto & mask : masks.masks())
+	{
+		if (mask.find_first_of("*?\\") != std::string::npos)
+			wildcards_.push_back(mask);
+		/* anything else can only match a word it spells out */
+		else if (is_word(mask))
+			add_literal(mask);
+	}
+}
+
+void
+hilight_matcher::add_literal(const std::string & word)
+{
+	int state = 0;
+	for (char c : word)
+	{
+		auto folded = rfc_tolower(c);
+		auto & next = trie_[state].next;
+		auto pos = std::lower_bound(next.begin(), next.end(),
+			std::make_pair(folded, 0));
+		if (pos != next.end() && pos->first == folded)
+		{
+			state = pos->second;
+			continue;
+		}
+		int child = static_cast<int>(trie_.size());
+		next.insert(pos, std::make_pair(folded, child));
+		trie_.push_back(node());
+		trie_.back().terminal = false;
+		state = child;
+	}
+	trie_[state].terminal = true;
+}
+
+/* the state after |c|, or -1 once no literal can match any more */
+int
+hilight_matcher::step(int state, unsigned char c) const
+{
+	const auto & next = trie_[state].next;
+	auto pos = std::lower_bound(next.begin(), next.end(), std::make_pair(c, 0));
+	if (pos == next.end() || pos->first != c)
+		return -1;
+	return pos->second;
+}
+
+bool
+hilight_matcher::word_matches(const char *begin, const char *end, int state, std::string & buf) const
+{
+	if (state >= 0 && trie_[state].terminal)
+		return true;
+	if (wildcards_.empty())
+		return false;
+	buf.assign(begin, end);
+	for (const auto & mask : wildcards_)
+		if (::match(mask.c_str(), buf.c_str()))
+			return true;
+	return false;
+}
+
+/* Words are walked down the trie as they are scanned; a word boundary
+   resets it, since a literal has to cover the whole word anyway. Only
+   wildcard masks need the word on its own. */
+bool
+hilight_matcher::search(const boost::string_ref & text) const
+{
+	if (trie_.size() == 1 && wildcards_.empty())
+		return false;
+
+	std::string buf;
+	const char *p = text.data(), *end = p + text.size(), *word = p;
+	int state = 0;
+	while (p < end)
+	{
+		auto len = word_char(p, end);
+		if (!len)
+		{
+			if (p > word && word_matches(word, p, state, buf))
+				return true;
+			p += char_len(p, end);
+			word = p;
+			state = 0;
+			continue;
+		}
+		for (auto q = p; q < p + len && state >= 0; ++q)
+			state = step(state, rfc_tolower(*q));
+		p += len;
+	}
+	return p > word && word_matches(word, end, state, buf);
+}
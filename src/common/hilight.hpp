@@ -0,0 +1,73 @@
+/* HexChat
+ * Copyright (C) 1998-2010 Peter Zelezny.
+ * Copyright (C) 2009-2013 Berke Viktor.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#ifndef HEXCHAT_HILIGHT_HPP
+#define HEXCHAT_HILIGHT_HPP
+
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/utility/string_ref.hpp>
+
+/* A list of masks separated by commas and spaces, as in the Alerts
+   preferences, split once. */
+class mask_list
+{
+public:
+	/* resplits only if |masks| differs from the last source; returns
+	   whether it did */
+	bool update(const boost::string_ref & masks);
+	/* does any mask match the whole of |word|? */
+	bool match(const char *word) const;
+	bool empty() const { return masks_.empty(); }
+	const std::vector<std::string> & masks() const { return masks_; }
+private:
+	std::string source_;
+	std::vector<std::string> masks_;
+};
+
+/* Finds a highlight word in a line. Literal masks go into a trie of their
+   rfc1459-folded bytes; masks with wildcards are tried with match(). A
+   mask must cover a whole word, where words are made of letters, digits
+   and the RFC 1459 specials, so one scan of the line does. */
+class hilight_matcher
+{
+public:
+	hilight_matcher();
+	/* recompiles only if the nick or the masks changed */
+	void update(const boost::string_ref & nick, const boost::string_ref & masks);
+	bool search(const boost::string_ref & text) const;
+private:
+	struct node
+	{
+		std::vector<std::pair<unsigned char, int> > next;	/* sorted */
+		bool terminal;
+	};
+	void compile(const mask_list & masks);
+	void add_literal(const std::string & word);
+	int step(int state, unsigned char c) const;
+	bool word_matches(const char *begin, const char *end, int state, std::string & buf) const;
+
+	mask_list nick_masks_;
+	mask_list extra_masks_;
+	std::vector<node> trie_;
+	std::vector<std::string> wildcards_;
+};
+
+#endif
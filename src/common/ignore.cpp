@@ -16,7 +16,12 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
  */
 
+#include <algorithm>
+#include <array>
+#include <memory>
 #include <sstream>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 #include <cstdlib>
 #include <cstdio>
@@ -24,6 +29,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <boost/chrono.hpp>
 #include <boost/format.hpp>
 #include <boost/optional.hpp>
 #include <boost/utility/string_ref.hpp>
@@ -55,6 +61,332 @@ int ignored_invi = 0;
 
 static std::vector<ignore> ignores;
 static int ignored_total = 0;
+
+namespace
+{
+	/* masks folded the way match() compares them */
+	std::string fold(const boost::string_ref & text)
+	{
+		std::string folded(text.size(), '\0');
+		std::transform(text.begin(), text.end(), folded.begin(),
+			[](char c){ return static_cast<char>(rfc_tolower(c)); });
+		return folded;
+	}
+
+	bool has_wildcards(const boost::string_ref & mask)
+	{
+		return std::find_if(mask.begin(), mask.end(), [](char c){
+			return c == '*' || c == '?' || c == '\\';
+		}) != mask.end();
+	}
+
+	/* The ignore list compiled for ignore_check. Every folded mask lands
+	   in one place:
+	     exact     no wildcards at all, hashed
+	     hosts     *!*@host, hashed by host
+	     suffixes  *L, *@*L and *!*@*L, in a trie of reversed L
+	     prefixes  anything else starting with a literal, in a trie of
+	               that literal and confirmed with match()
+	     residual  the rest, tried with match() one by one
+	   so a check walks the subject a few times whatever the list size. */
+	class ignore_index
+	{
+	public:
+		enum result { none, ignored, unignored };
+
+		ignore_index()
+			:suffixes_(1), prefixes_(1)
+		{
+			counts_.fill(0);
+		}
+
+		void add(const ignore & ig)
+		{
+			auto folded = fold(ig.mask);
+			count(ig.type, 1);
+			boost::string_ref mask(folded);
+			if (!has_wildcards(mask))
+			{
+				bucket_for(exact_, mask).push_back(ig.type);
+				return;
+			}
+			suffix_kind kind;
+			boost::string_ref literal;
+			if (host_form(mask, literal))
+			{
+				bucket_for(hosts_, literal).push_back(ig.type);
+				return;
+			}
+			if (suffix_form(mask, kind, literal))
+			{
+				int node = 0;
+				for (auto c = literal.rbegin(); c != literal.rend(); ++c)
+					node = child(suffixes_, node, *c, true);
+				suffixes_[node].entries.push_back(std::make_pair(kind, ig.type));
+				return;
+			}
+			auto prefix_len = std::min(mask.find_first_of("*?\\"), mask.size());
+			if (prefix_len)
+			{
+				int node = 0;
+				for (std::size_t i = 0; i < prefix_len; ++i)
+					node = child(prefixes_, node, mask[i], true);
+				prefixes_[node].entries.push_back(std::make_pair(folded, ig.type));
+				return;
+			}
+			residual_.push_back(std::make_pair(folded, ig.type));
+		}
+
+		/* drops every entry for |mask| */
+		void remove(const boost::string_ref & mask)
+		{
+			auto folded = fold(mask);
+			boost::string_ref key(folded);
+			if (!has_wildcards(key))
+			{
+				drop_bucket(exact_, key);
+				return;
+			}
+			suffix_kind kind;
+			boost::string_ref literal;
+			if (host_form(key, literal))
+			{
+				drop_bucket(hosts_, literal);
+				return;
+			}
+			if (suffix_form(key, kind, literal))
+			{
+				int node = 0;
+				for (auto c = literal.rbegin(); c != literal.rend() && node >= 0; ++c)
+					node = child(suffixes_, node, *c, false);
+				if (node < 0)
+					return;
+				auto & entries = suffixes_[node].entries;
+				auto end = std::remove_if(entries.begin(), entries.end(),
+					[this, kind](const std::pair<suffix_kind, ignore::ignore_type> & e){
+						if (e.first != kind)
+							return false;
+						count(e.second, -1);
+						return true;
+					});
+				entries.erase(end, entries.end());
+				return;
+			}
+			auto prefix_len = std::min(key.find_first_of("*?\\"), key.size());
+			if (prefix_len)
+			{
+				int node = 0;
+				for (std::size_t i = 0; i < prefix_len && node >= 0; ++i)
+					node = child(prefixes_, node, key[i], false);
+				if (node >= 0)
+					drop_masks(prefixes_[node].entries, folded);
+				return;
+			}
+			drop_masks(residual_, folded);
+		}
+
+		/* every type some mask is set for */
+		ignore::ignore_type types() const
+		{
+			ignore::ignore_type result = 0;
+			for (std::size_t bit = 0; bit < counts_.size(); ++bit)
+				if (counts_[bit])
+					result |= 1u << bit;
+			return result;
+		}
+
+		/* an UNIGNORE for |type| wins over any ignore */
+		result check(const boost::string_ref & subject, ignore::ignore_type type) const
+		{
+			auto folded = fold(subject);
+			boost::string_ref s(folded);
+			auto at = s.rfind('@');
+			bool bang_before_at = at != boost::string_ref::npos && s.substr(0, at).find('!') != boost::string_ref::npos;
+			bool hit = false;
+			/* false once an UNIGNORE has matched */
+			auto consider = [type, &hit](ignore::ignore_type t){
+				if (!(t & type))
+					return true;
+				if (t & ignore::IG_UNIG)
+					return false;
+				hit = true;
+				return true;
+			};
+
+			auto res = exact_.find(s);
+			if (res != exact_.end())
+				for (auto t : res->second->types)
+					if (!consider(t))
+						return unignored;
+
+			if (bang_before_at)
+			{
+				res = hosts_.find(s.substr(at + 1));
+				if (res != hosts_.end())
+					for (auto t : res->second->types)
+						if (!consider(t))
+							return unignored;
+			}
+
+			int node = 0;
+			for (std::size_t i = s.size(); i-- > 0;)
+			{
+				node = child(suffixes_, node, s[i], false);
+				if (node < 0)
+					break;
+				for (const auto & e : suffixes_[node].entries)
+				{
+					bool matches = e.first == suffix_plain
+						|| (e.first == suffix_at && at != boost::string_ref::npos && at < i)
+						|| (e.first == suffix_userhost && bang_before_at && at < i);
+					if (matches && !consider(e.second))
+						return unignored;
+				}
+			}
+
+			node = 0;
+			for (std::size_t i = 0; i < s.size(); ++i)
+			{
+				node = child(prefixes_, node, s[i], false);
+				if (node < 0)
+					break;
+				for (const auto & e : prefixes_[node].entries)
+					if ((e.second & type) && match(e.first.c_str(), folded.c_str()) && !consider(e.second))
+						return unignored;
+			}
+
+			for (const auto & e : residual_)
+				if ((e.second & type) && match(e.first.c_str(), folded.c_str()) && !consider(e.second))
+					return unignored;
+
+			return hit ? ignored : none;
+		}
+
+	private:
+		enum suffix_kind { suffix_plain, suffix_at, suffix_userhost };
+		struct bucket
+		{
+			std::string key;
+			std::vector<ignore::ignore_type> types;
+		};
+		typedef std::unordered_map<boost::string_ref, std::unique_ptr<bucket>, string_ref_hash> bucket_map;
+		template<typename Entry>
+		struct node
+		{
+			std::vector<std::pair<char, int> > next;	/* sorted */
+			std::vector<Entry> entries;
+		};
+		typedef node<std::pair<suffix_kind, ignore::ignore_type> > suffix_node;
+		typedef node<std::pair<std::string, ignore::ignore_type> > prefix_node;
+
+		/* *!*@host with a literal host */
+		static bool host_form(const boost::string_ref & mask, boost::string_ref & host)
+		{
+			if (!mask.starts_with("*!*@"))
+				return false;
+			host = mask.substr(4);
+			return !host.empty() && !has_wildcards(host) && host.find('@') == boost::string_ref::npos;
+		}
+
+		/* *L, *@*L or *!*@*L with a literal L free of '@' */
+		static bool suffix_form(const boost::string_ref & mask, suffix_kind & kind, boost::string_ref & literal)
+		{
+			if (mask.starts_with("*!*@*"))
+			{
+				kind = suffix_userhost;
+				literal = mask.substr(5);
+			}
+			else if (mask.starts_with("*@*"))
+			{
+				kind = suffix_at;
+				literal = mask.substr(3);
+			}
+			else if (mask.starts_with("*"))
+			{
+				kind = suffix_plain;
+				literal = mask.substr(1);
+			}
+			else
+				return false;
+			return !literal.empty() && !has_wildcards(literal)
+				&& (kind == suffix_plain || literal.find('@') == boost::string_ref::npos);
+		}
+
+		template<typename Node>
+		static int child(std::vector<Node> & trie, int parent, char c, bool create)
+		{
+			auto & next = trie[parent].next;
+			auto pos = std::lower_bound(next.begin(), next.end(), std::make_pair(c, 0));
+			if (pos != next.end() && pos->first == c)
+				return pos->second;
+			if (!create)
+				return -1;
+			int result = static_cast<int>(trie.size());
+			next.insert(pos, std::make_pair(c, result));
+			trie.push_back(Node());
+			return result;
+		}
+
+		template<typename Node>
+		static int child(const std::vector<Node> & trie, int parent, char c, bool)
+		{
+			const auto & next = trie[parent].next;
+			auto pos = std::lower_bound(next.begin(), next.end(), std::make_pair(c, 0));
+			if (pos != next.end() && pos->first == c)
+				return pos->second;
+			return -1;
+		}
+
+		static std::vector<ignore::ignore_type> & bucket_for(bucket_map & map, const boost::string_ref & key)
+		{
+			auto res = map.find(key);
+			if (res != map.end())
+				return res->second->types;
+			std::unique_ptr<bucket> fresh(new bucket);
+			fresh->key = key.to_string();
+			boost::string_ref stored(fresh->key);
+			return map.emplace(stored, std::move(fresh)).first->second->types;
+		}
+
+		void drop_bucket(bucket_map & map, const boost::string_ref & key)
+		{
+			auto res = map.find(key);
+			if (res == map.end())
+				return;
+			for (auto t : res->second->types)
+				count(t, -1);
+			map.erase(res);
+		}
+
+		void drop_masks(std::vector<std::pair<std::string, ignore::ignore_type> > & entries, const std::string & folded)
+		{
+			auto end = std::remove_if(entries.begin(), entries.end(),
+				[this, &folded](const std::pair<std::string, ignore::ignore_type> & e){
+					if (e.first != folded)
+						return false;
+					count(e.second, -1);
+					return true;
+				});
+			entries.erase(end, entries.end());
+		}
+
+		void count(ignore::ignore_type type, int delta)
+		{
+			for (std::size_t bit = 0; bit < counts_.size(); ++bit)
+				if (type & (1u << bit))
+					counts_[bit] += delta;
+		}
+
+		bucket_map exact_;
+		bucket_map hosts_;
+		std::vector<suffix_node> suffixes_;
+		std::vector<prefix_node> prefixes_;
+		std::vector<std::pair<std::string, ignore::ignore_type> > residual_;
+		std::array<int, 8> counts_;	/* masks per IG_* bit */
+	};
+
+	ignore_index compiled;
+}
 /* ignore_exists ():
  * returns: struct ig, if this mask is in the ignore list already
  *          NULL, otherwise
@@ -100,6 +432,10 @@ ignore_add(const std::string& mask, int type, bool overwrite)
 	else
 		ig->type = type;
 
+	/* the list holds one entry per mask, so this one replaces whatever
+	   the index had for it */
+	compiled.remove (mask);
+	compiled.add (ig.get());
 	if (!change_only)
 		ignores.push_back(ig.get());
 	fe_ignore_update (1);
@@ -177,7 +513,8 @@ ignore_del(const std::string& mask)
 	auto res = ignores.erase(
 		std::remove_if(ignores.begin(), ignores.end(), [&mask](const ignore & ig){
 			return !rfc_casecmp(ig.mask.c_str(), mask.c_str());
-		}));
+		}), ignores.end());
+	compiled.remove(mask);
 	fe_ignore_update(1);
 	return ignores.size() != old_size;
 }
@@ -186,43 +523,26 @@ ignore_del(const std::string& mask)
 
 bool ignore_check(const boost::string_ref& mask, ignore::ignore_type type)
 {
-	/* check if there's an UNIGNORE first, they take precendance. */
-	for(const auto & ig : ignores)
-	{
-		if (ig.type & ignore::IG_UNIG)
-		{
-			if (ig.type & type)
-			{
-				if (match (ig.mask.c_str(), mask.data()))
-					return false;
-			}
-		}
-	}
-
-	for(const auto & ig : ignores)
-	{
-		if (ig.type & type)
-		{
-			if (match (ig.mask.c_str(), mask.data()))
-			{
-				ignored_total++;
-				if (type & ignore::IG_PRIV)
-					ignored_priv++;
-				if (type & ignore::IG_NOTI)
-					ignored_noti++;
-				if (type & ignore::IG_CHAN)
-					ignored_chan++;
-				if (type & ignore::IG_CTCP)
-					ignored_ctcp++;
-				if (type & ignore::IG_INVI)
-					ignored_invi++;
-				fe_ignore_update (2);
-				return true;
-			}
-		}
-	}
-
-	return false;
+	if (!(compiled.types() & type))
+		return false;
+
+	/* an UNIGNORE takes precedence */
+	if (compiled.check(mask, type) != ignore_index::ignored)
+		return false;
+
+	ignored_total++;
+	if (type & ignore::IG_PRIV)
+		ignored_priv++;
+	if (type & ignore::IG_NOTI)
+		ignored_noti++;
+	if (type & ignore::IG_CHAN)
+		ignored_chan++;
+	if (type & ignore::IG_CTCP)
+		ignored_ctcp++;
+	if (type & ignore::IG_INVI)
+		ignored_invi++;
+	fe_ignore_update (2);
+	return true;
 }
 
 static char *
@@ -270,7 +590,10 @@ ignore_load ()
 			{
 				ignore ig;
 				if ((my_cfg = ignore_read_next_entry(my_cfg, ig)))
+				{
+					compiled.add(ig);
 					ignores.emplace_back(std::move(ig));
+				}
 			}
 		}
 		close (fh);
@@ -306,89 +629,215 @@ flood_autodialog_timeout (gpointer)
 	return FALSE;
 }
 
+flood_bucket::flood_bucket()
+	:tokens()
+{
+}
+
+bool
+flood_bucket::take(boost::chrono::steady_clock::time_point now, int burst, int period)
+{
+	namespace chrono = boost::chrono;
+	if (burst <= 0 || period <= 0)
+		return true;
+
+	if (last == chrono::steady_clock::time_point())
+		tokens = burst;	/* first message from here */
+	else
+	{
+		auto ms = chrono::duration_cast<chrono::milliseconds>(now - last).count();
+		tokens = std::min<double>(burst, tokens + ms * static_cast<double>(burst) / (period * 1000.0));
+	}
+	last = now;
+
+	if (tokens < 1.0)
+		return false;
+	tokens -= 1.0;
+	return true;
+}
+
+flood_state::flood_state()
+	:ctcp_flooding(false), msg_flooding(false), stats()
+{
+}
+
+flood_state::source &
+flood_state::lookup(const boost::string_ref & host)
+{
+	auto res = index_.find(host);
+	if (res != index_.end())
+	{
+		lru_.splice(lru_.begin(), lru_, res->second);
+		return *res->second;
+	}
+
+	if (lru_.size() >= max_sources)
+	{
+		index_.erase(lru_.back().host);
+		lru_.pop_back();
+		stats.evictions++;
+	}
+	lru_.push_front(source());
+	lru_.front().host = host.to_string();
+	index_.emplace(lru_.front().host, lru_.begin());
+	return lru_.front();
+}
+
+flood_stats
+flood_state::usage() const
+{
+	flood_stats result = stats;
+	result.sources = lru_.size();
+	return result;
+}
+
+namespace
+{
+	/* how long a flood's auto-ignore lasts */
+	const unsigned int flood_ignore_ms = 10 * 60 * 1000;
+	/* the server's buckets hold this many times a single host's, so a
+	   burst from several well-behaved hosts isn't taken for a flood */
+	const int flood_server_factor = 10;
+
+	/* each auto-ignore gets a new generation, so a timer left over from
+	   an ignore the user deleted can't expire one added after it */
+	struct flood_ignore_timer
+	{
+		std::string mask;
+		unsigned int generation;
+	};
+	unsigned int flood_ignore_last_generation;
+	std::unordered_map<std::string, unsigned int> flood_ignore_generations;
+
+	gboolean flood_ignore_expire(gpointer data)
+	{
+		std::unique_ptr<flood_ignore_timer> timer(static_cast<flood_ignore_timer*>(data));
+		auto res = flood_ignore_generations.find(timer->mask);
+		if (res == flood_ignore_generations.end() || res->second != timer->generation)
+			return FALSE;
+		flood_ignore_generations.erase(res);
+		/* unless the user has changed it since */
+		auto ig = ignore_exists(timer->mask);
+		if (ig && ig->type == (ignore::IG_CTCP | ignore::IG_NOSAVE))
+			ignore_del(timer->mask);
+		return FALSE;
+	}
+
+	void flood_ignore_add(const std::string & mask)
+	{
+		ignore_add(mask, ignore::IG_CTCP | ignore::IG_NOSAVE, false);
+		std::unique_ptr<flood_ignore_timer> timer(new flood_ignore_timer);
+		timer->mask = mask;
+		timer->generation = ++flood_ignore_last_generation;
+		flood_ignore_generations[mask] = timer->generation;
+		fe_timeout_add(flood_ignore_ms, flood_ignore_expire, timer.release());
+	}
+
+	/* the host of nick!user@host, or the nick if there is none */
+	boost::string_ref flood_source(const char *nick, const char *ip)
+	{
+		if (ip)
+		{
+			auto at = std::strrchr(ip, '@');
+			if (at && at[1])
+				return boost::string_ref(at + 1);
+		}
+		return boost::string_ref(nick ? nick : "");
+	}
+}
+
+/* Returns false if the message is part of a flood. Each message takes a
+   token from its host's bucket and from the server's; a host's buckets
+   hold flood_*_num tokens and refill that many per flood_*_time seconds,
+   the server's flood_server_factor times as many at the same rate. A
+   host running dry is ignored for CTCPs (for a while) or gets no dialog;
+   the server running dry means many hosts at once, so CTCPs go
+   unanswered and dialogs stop opening until it refills. */
 bool
-flood_check (const char *nick, const char *ip, server &serv, session *sess, flood_check_type what)	/*0=ctcp  1=priv */
+flood_check (const char *nick, const char *ip, server &serv, session *sess, flood_check_type what)
 {
-	/*
-	   serv
-	   int ctcp_counter; 
-	   time_t ctcp_last_time;
-	   prefs
-	   unsigned int ctcp_number_limit;
-	   unsigned int ctcp_time_limit;
-	 */
+	if (!serv.flood)
+		serv.flood.reset (new flood_state);
+	auto & flood = *serv.flood;
+	auto now = boost::chrono::steady_clock::now ();
+	auto host = flood_source (nick, ip);
+	auto & source = flood.lookup (host);
 	char buf[512];
-	char real_ip[132];
-	int i;
-	time_t current_time;
-	current_time = time (NULL);
 
 	if (what == flood_check_type::CTCP)
 	{
-		if (serv.ctcp_last_time == 0)	/*first ctcp in this server */
+		flood.stats.ctcps++;
+		int num = prefs.hex_flood_ctcp_num;
+		int period = prefs.hex_flood_ctcp_time;
+		if (!source.ctcp.take (now, num, period))
 		{
-			serv.ctcp_last_time = time (NULL);
-			serv.ctcp_counter++;
-		} else
+			flood.stats.source_floods++;
+			std::string mask = (ip && std::strchr (ip, '@')) ? "*!*@" + host.to_string() : host.to_string() + "!*@*";
+			if (!ignore_exists (mask))
+			{
+				snprintf (buf, sizeof (buf),
+							 _("You are being CTCP flooded from %s, ignoring %s\n"),
+							 nick, mask.c_str());
+				PrintText (sess, buf);
+				flood_ignore_add (mask);
+				flood.stats.auto_ignores++;
+			}
+			return false;
+		}
+		if (!flood.ctcp.take (now, num * flood_server_factor, period))
 		{
-			if (difftime (current_time, serv.ctcp_last_time) < prefs.hex_flood_ctcp_time)	/*if we got the ctcp in the seconds limit */
+			flood.stats.server_floods++;
+			if (!flood.ctcp_flooding)
 			{
-				serv.ctcp_counter++;
-				if (serv.ctcp_counter == prefs.hex_flood_ctcp_num)	/*if we reached the maximun numbers of ctcp in the seconds limits */
-				{
-					serv.ctcp_last_time = current_time;	/*we got the flood, restore all the vars for next one */
-					serv.ctcp_counter = 0;
-					for (i = 0; i < 128; i++)
-						if (ip[i] == '@')
-							break;
-					snprintf (real_ip, sizeof (real_ip), "*!*%s", &ip[i]);
-
-					snprintf (buf, sizeof (buf),
-								 _("You are being CTCP flooded from %s, ignoring %s\n"),
-								 nick, real_ip);
-					PrintText (sess, buf);
-
-					/* ignore CTCP */
-					ignore_add(real_ip, ignore::IG_CTCP, FALSE);
-					return false;
-				}
+				PrintText (sess, _("You are being CTCP flooded from many hosts, not answering CTCPs for now\n"));
+				flood.ctcp_flooding = true;
 			}
+			return false;
 		}
+		flood.ctcp_flooding = false;
 	} else
 	{
-		if (serv.msg_last_time == 0)
+		flood.stats.msgs++;
+		int num = prefs.hex_flood_msg_num;
+		int period = prefs.hex_flood_msg_time;
+		if (!source.msg.take (now, num, period))
 		{
-			serv.msg_last_time = time (NULL);
-			serv.ctcp_counter++;
-		} else
+			flood.stats.source_floods++;
+			return false;
+		}
+		if (!flood.msg.take (now, num * flood_server_factor, period))
 		{
-			if (difftime (current_time, serv.msg_last_time) <
-				 prefs.hex_flood_msg_time)
+			flood.stats.server_floods++;
+			if (!flood.msg_flooding)
 			{
-				serv.msg_counter++;
-				if (serv.msg_counter == prefs.hex_flood_msg_num)	/*if we reached the maximun numbers of ctcp in the seconds limits */
+				snprintf (buf, sizeof (buf),
+				 _("You are being MSG flooded from %s, setting gui_autoopen_dialog OFF.\n"),
+							 ip);
+				PrintText (sess, buf);
+				flood.msg_flooding = true;
+
+				if (prefs.hex_gui_autoopen_dialog)
 				{
-					snprintf (buf, sizeof (buf),
-					 _("You are being MSG flooded from %s, setting gui_autoopen_dialog OFF.\n"),
-								 ip);
-					PrintText (sess, buf);
-					serv.msg_last_time = current_time;	/*we got the flood, restore all the vars for next one */
-					serv.msg_counter = 0;
-
-					if (prefs.hex_gui_autoopen_dialog)
-					{
-						prefs.hex_gui_autoopen_dialog = 0;
-						/* turn it back on in 30 secs */
-						fe_timeout_add (30000, flood_autodialog_timeout, NULL);
-					}
-					return false;
+					prefs.hex_gui_autoopen_dialog = 0;
+					/* turn it back on in 30 secs */
+					fe_timeout_add (30000, flood_autodialog_timeout, NULL);
 				}
 			}
+			return false;
 		}
+		flood.msg_flooding = false;
 	}
 	return true;
 }
 
+flood_stats
+flood_usage (const server &serv)
+{
+	if (!serv.flood)
+		return flood_stats();
+	return serv.flood->usage();
+}
+
 const std::vector<ignore>&
 get_ignore_list()
 {
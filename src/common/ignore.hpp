@@ -20,11 +20,16 @@
 #ifndef HEXCHAT_IGNORE_HPP
 #define HEXCHAT_IGNORE_HPP
 
+#include <cstddef>
+#include <list>
 #include <string>
+#include <unordered_map>
 #include <vector>
+#include <boost/chrono.hpp>
 #include <boost/optional/optional_fwd.hpp>
-#include <boost/utility/string_ref_fwd.hpp>
+#include <boost/utility/string_ref.hpp>
 #include "serverfwd.hpp"
+#include "util.hpp"
 
 extern int ignored_ctcp;
 extern int ignored_priv;
@@ -60,6 +65,55 @@ enum class flood_check_type
 	PRIV
 };
 
+/* a token bucket: up to |burst| messages at once, refilled at |burst|
+   per |period| seconds */
+struct flood_bucket
+{
+	flood_bucket();
+	/* takes one token; false if there was none left */
+	bool take(boost::chrono::steady_clock::time_point now, int burst, int period);
+	double tokens;
+	boost::chrono::steady_clock::time_point last;
+};
+
+struct flood_stats
+{
+	std::size_t ctcps;
+	std::size_t msgs;
+	std::size_t sources;	/* hosts tracked right now */
+	std::size_t source_floods;
+	std::size_t server_floods;
+	std::size_t auto_ignores;
+	std::size_t evictions;	/* hosts dropped to stay under max_sources */
+};
+
+/* flood_check's state for one server: one bucket pair for the whole
+   server, which catches floods spread over many hosts, and one per
+   source host, kept for the most recently seen hosts only */
+class flood_state
+{
+public:
+	static const std::size_t max_sources = 512;
+	struct source
+	{
+		std::string host;
+		flood_bucket ctcp;
+		flood_bucket msg;
+	};
+	flood_state();
+	source & lookup(const boost::string_ref & host);
+	flood_stats usage() const;
+
+	flood_bucket ctcp;
+	flood_bucket msg;
+	bool ctcp_flooding;	/* already told the user */
+	bool msg_flooding;
+	flood_stats stats;
+private:
+	std::list<source> lru_;	/* most recently seen first */
+	std::unordered_map<boost::string_ref, std::list<source>::iterator, string_ref_hash> index_;
+};
+
 const std::vector<ignore>& get_ignore_list();
 boost::optional<ignore &> ignore_exists (const boost::string_ref& mask);
 int ignore_add(const std::string& mask, int type, bool overwrite);
@@ -71,5 +125,6 @@ void ignore_save (void);
 void ignore_gui_open (void);
 void ignore_gui_update (int level);
 bool flood_check (const char *nick, const char *ip, server &serv, session *sess, flood_check_type what);
+flood_stats flood_usage (const server &serv);
 
 #endif
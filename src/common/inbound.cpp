@@ -54,6 +54,7 @@
 #include "notify.hpp"
 #include "outbound.hpp"
 #include "inbound.hpp"
+#include "hilight.hpp"
 #include "server.hpp"
 #include "servlist.hpp"
 #include "text.hpp"
@@ -72,6 +73,7 @@ clear_channel (session &sess)
 	if (sess.channel[0])
 		strcpy (sess.waitchannel, sess.channel);
 	sess.channel[0] = 0;
+	session_index (sess);
 	sess.doing_who = false;
 	sess.done_away_check = false;
 
@@ -117,15 +119,10 @@ find_session_from_nick (const char *nick, server &serv)
 			return current_sess;
 	}
 
-	for (auto list = sess_list; list; list = g_slist_next(list))
-	{
-		sess = static_cast<session*>(list->data);
-		if (sess->server == &serv)
-		{
-			if (userlist_find (sess, nick))
-				return sess;
-		}
-	}
+	/* any channel we share with it */
+	auto info = userlist_lookup (serv, nick);
+	if (info)
+		return info->channels.front ().first;
 	return 0;
 }
 
@@ -212,7 +209,7 @@ inbound_privmsg (server &serv, char *from, char *ip, char *text, bool id,
 	if (user)
 	{
 		user->lasttalk = time (0);
-		if (user->account)
+		if (user->info->account)
 			id = TRUE;
 	}
 	
@@ -233,28 +230,9 @@ bool alert_match_word (const char *word, const char *masks)
 	if (!masks || masks[0] == 0)
 		return false;
 
-	std::unique_ptr<char[]> mutable_masks(new_strdup(masks));
-	char *p = mutable_masks.get();
-
-	while (1)
-	{
-		/* if it's a 0, space or comma, the word has ended. */
-		if (*p == 0 || *p == ' ' || *p == ',')
-		{
-			auto endchar = *p;
-			*p = 0;
-			bool res = match (mutable_masks.get(), word);
-			*p = endchar;
-
-			if (res)
-				return true;	/* yes, matched! */
-
-			masks = p + 1;
-			if (*p == 0)
-				return false;
-		}
-		p++;
-	}
+	mask_list list;
+	list.update (masks);
+	return list.match (word);
 }
 
 bool alert_match_text (const char text[], const char masks[])
@@ -262,61 +240,28 @@ bool alert_match_text (const char text[], const char masks[])
 	if (!masks || masks[0] == 0)
 		return false;
 
-	std::unique_ptr<char[]> mutable_text(new_strdup(text));
-	unsigned char *p = reinterpret_cast<unsigned char*>(mutable_text.get());
-	char * i_text = mutable_text.get();
-
-	while (1)
-	{
-		if (*p >= '0' && *p <= '9')
-		{
-			p++;
-			continue;
-		}
-
-		/* if it's RFC1459 <special>, it can be inside a word */
-		switch (*p)
-		{
-		case '-': case '[': case ']': case '\\':
-		case '`': case '^': case '{': case '}':
-		case '_': case '|':
-			p++;
-			continue;
-		}
-
-		/* if it's a 0, space or comma, the word has ended. */
-		if (*p == 0 || *p == ' ' || *p == ',' ||
-			/* if it's anything BUT a letter, the word has ended. */
-			 (!g_unichar_isalpha (g_utf8_get_char ((const gchar*)p))))
-		{
-			auto endchar = *p;
-			*p = 0;
-			bool res = alert_match_word(i_text, masks);
-			*p = endchar;
-
-			if (res)
-				return true;	/* yes, matched! */
-
-			i_text = (char*)(p + g_utf8_skip [p[0]]);
-			if (*p == 0)
-				return false;
-		}
-
-		p += g_utf8_skip [p[0]];
-	}
+	hilight_matcher matcher;
+	matcher.update ("", masks);
+	return matcher.search (text);
 }
 
+/* the masks are split and compiled again only when the prefs or our
+   nick have changed since the last message */
 static bool
 is_hilight (const char from[], const char text[], session *sess, server &serv)
 {
-	if (alert_match_word (from, prefs.hex_irc_no_hilight))
+	static mask_list no_hilight;
+	static mask_list nick_hilight;
+
+	no_hilight.update (prefs.hex_irc_no_hilight);
+	if (no_hilight.match (from))
 		return false;
 
 	auto temp = strip_color (text, STRIP_ALL);
 
-	if (alert_match_text(temp.c_str(), serv.nick) ||
-		alert_match_text(temp.c_str(), prefs.hex_irc_extra_hilight) ||
-		alert_match_word(temp.c_str(), prefs.hex_irc_nick_hilight))
+	serv.hilight.update (serv.nick, prefs.hex_irc_extra_hilight);
+	nick_hilight.update (prefs.hex_irc_nick_hilight);
+	if (serv.hilight.search (temp) || nick_hilight.match (from))
 	{
 		if (sess != current_tab)
 		{
@@ -394,7 +339,7 @@ inbound_action (session *sess, const std::string& chan, char *from, char *ip, ch
 	{
 		nickchar[0] = user->prefix[0];
 		user->lasttalk = time (0);
-		if (user->account)
+		if (user->info->account)
 			id = true;
 		if (user->me)
 			fromme = true;
@@ -457,7 +402,7 @@ inbound_chanmsg (server &serv, session *sess, char *chan, char *from,
 	char nickchar[2] = "\000";
 	if (user)
 	{
-		if (user->account)
+		if (user->info->account)
 			id = true;
 		nickchar[0] = user->prefix[0];
 		user->lasttalk = time (0);
@@ -499,12 +444,14 @@ inbound_newnick (server &serv, char *nick, char *newnick, int quiet,
 		safe_strcpy (serv.nick, newnick, NICKLEN);
 	}
 
+	/* the directory knows which channels the nick is on */
+	auto info = userlist_change (serv, nick, newnick);
 	for (auto list = sess_list; list; list = g_slist_next(list))
 	{
 		auto sess = static_cast<session*>(list->data);
 		if (sess->server == &serv)
 		{
-			if (userlist_change(sess, nick, newnick) || (me && sess->type == session::SESS_SERVER))
+			if ((info && userlist_find (sess, newnick)) || (me && sess->type == session::SESS_SERVER))
 			{
 				if (!quiet)
 				{
@@ -520,6 +467,7 @@ inbound_newnick (server &serv, char *nick, char *newnick, int quiet,
 			if (sess->type == session::SESS_DIALOG && !serv.p_cmp(sess->channel, nick))
 			{
 				safe_strcpy (sess->channel, newnick, CHANLEN);
+				session_index (*sess);
 				fe_set_channel (sess);
 			}
 			fe_set_title (*sess);
@@ -589,6 +537,7 @@ inbound_ujoin (server &serv, char *chan, char *nick, char *ip,
 	}
 
 	safe_strcpy (sess->channel, chan, CHANLEN);
+	session_index (*sess);
 	if (found_unused)
 	{
 		chanopt_load (sess);
@@ -679,6 +628,8 @@ inbound_nameslist (server &serv, char *chan, char *names,
 		sess->end_of_names = FALSE;
 		userlist_clear (sess);
 	}
+	/* the GUI gets the whole list at once on 366 */
+	userlist_begin_load (*sess);
 
 	std::istringstream namesbuff{ names };
 	for (std::string token; std::getline(namesbuff, token, ' ');)
@@ -804,6 +755,20 @@ inbound_quit (server &serv, char *nick, char *ip, char *reason,
 {
 	bool was_on_front_session = false;
 
+	/* only the channels the nick is on; removing the last one drops the
+	   directory entry, so walk a copy */
+	auto info = userlist_lookup (serv, nick);
+	if (info)
+	{
+		auto channels = info->channels;
+		for (auto & member : channels)
+		{
+			EMIT_SIGNAL_TIMESTAMP (XP_TE_QUIT, member.first, nick, reason, ip, nullptr, 0,
+										  tags_data->timestamp);
+			userlist_remove_user (member.first, member.second);
+		}
+	}
+
 	for(auto list = sess_list; list; list = g_slist_next(list))
 	{
 		auto sess = static_cast<session *>(list->data);
@@ -811,14 +776,7 @@ inbound_quit (server &serv, char *nick, char *ip, char *reason,
 		{
 			if (sess == current_sess)
 				was_on_front_session = true;
-			struct User *user;
-			if ((user = userlist_find (sess, nick)))
-			{
-				EMIT_SIGNAL_TIMESTAMP (XP_TE_QUIT, sess, nick, reason, ip, nullptr, 0,
-											  tags_data->timestamp);
-				userlist_remove_user (sess, user);
-			}
-			else if (sess->type == session::SESS_DIALOG && !serv.p_cmp(sess->channel, nick))
+			if (sess->type == session::SESS_DIALOG && !serv.p_cmp(sess->channel, nick))
 			{
 				EMIT_SIGNAL_TIMESTAMP (XP_TE_QUIT, sess, nick, reason, ip, nullptr, 0,
 											  tags_data->timestamp);
@@ -830,15 +788,20 @@ inbound_quit (server &serv, char *nick, char *ip, char *reason,
 }
 
 void
-inbound_account (const server &serv, const char *nick, const char *account,
+inbound_account (server &serv, const char *nick, const char *account,
 					  const message_tags_data *tags_data)
 {
-	for (auto list = sess_list; list; list = g_slist_next(list))
-	{
-		auto sess = static_cast<session*>(list->data);
-		if (sess->server == &serv)
-			userlist_set_account (sess, nick, account);
-	}
+	userlist_set_account (serv, nick, account);
+}
+
+void
+inbound_chghost (server &serv, const char *nick, const char *user, const char *host,
+					  const message_tags_data *tags_data)
+{
+	std::string uhost (user);
+	uhost += '@';
+	uhost += host;
+	userlist_set_hostname (serv, nick, uhost.c_str ());
 }
 
 void
@@ -1026,24 +989,21 @@ inbound_away (server &serv, char *nick, char *msg,
 		EMIT_SIGNAL_TIMESTAMP (XP_TE_WHOIS5, sess, nick, msg, nullptr, nullptr, 0,
 									  tags_data->timestamp);
 
-	for (auto list = sess_list; list; list = g_slist_next(list))
-	{
-		auto sess = static_cast<session*>(list->data);
-		if (sess->server == &serv)
-			userlist_set_away (sess, nick, true);
-	}
+	userlist_set_away (serv, nick, true);
 }
 
 void
-inbound_away_notify (const server &serv, char *nick, char *reason,
+inbound_away_notify (server &serv, char *nick, char *reason,
 							const message_tags_data *tags_data)
 {
+	userlist_set_away (serv, nick, reason ? true : false);
+	if (reason)
+		serv.save_away_message (nick, std::string(reason));
 	for (auto list = sess_list; list; list = g_slist_next(list))
 	{
 		auto sess = static_cast<session*>(list->data);
 		if (sess->server == &serv)
 		{
-			userlist_set_away (sess, nick, reason ? true : false);
 			if (sess == serv.front_session && notify_is_in_list (serv, nick))
 			{
 				if (reason)
@@ -1070,6 +1030,7 @@ inbound_nameslist_end (const server &serv, const std::string & chan,
 			{
 				sess->end_of_names = true;
 				sess->ignore_names = false;
+				userlist_end_load (*sess);
 			}
 		}
 		return true;
@@ -1079,6 +1040,7 @@ inbound_nameslist_end (const server &serv, const std::string & chan,
 	{
 		sess->end_of_names = true;
 		sess->ignore_names = false;
+		userlist_end_load (*sess);
 		return true;
 	}
 	return false;
@@ -1324,14 +1286,9 @@ inbound_login_start (session *sess, char *nick, char *servname,
 }
 
 static void
-inbound_set_all_away_status (const server &serv, const char *nick, bool away)
+inbound_set_all_away_status (server &serv, const char *nick, bool away)
 {
-	for (auto list = sess_list; list; list = g_slist_next(list))
-	{
-		auto sess = static_cast<session*>(list->data);
-		if (sess->server == &serv)
-			userlist_set_away (sess, nick, away);
-	}
+	userlist_set_away (serv, nick, away);
 }
 
 void
@@ -1399,7 +1356,7 @@ inbound_user_info (session *sess, char *chan, char *user, char *host,
 	{
 		auto who_sess = find_channel (*serv, chan);
 		if (who_sess)
-			userlist_add_hostname (who_sess, nick, uhost.get(), realname, servname, account, away);
+			userlist_add_hostname (*serv, nick, uhost.get(), realname, servname, account, away);
 		else
 		{
 			if (serv->doing_dns && nick && host)
@@ -1409,14 +1366,7 @@ inbound_user_info (session *sess, char *chan, char *user, char *host,
 	else
 	{
 		/* came from WHOIS, not channel specific */
-		for (auto list = sess_list; list; list = g_slist_next(list))
-		{
-			auto sess = static_cast<session*>(list->data);
-			if (sess->type == session::SESS_CHANNEL && sess->server == serv)
-			{
-				userlist_add_hostname (sess, nick, uhost.get(), realname, servname, account, away);
-			}
-		}
+		userlist_add_hostname (*serv, nick, uhost.get(), realname, servname, account, away);
 	}
 }
 
@@ -1680,6 +1630,11 @@ inbound_cap_ls (server &serv, char *nick, char *extensions_str,
 			strcat (buffer, "userhost-in-names ");
 			want_cap = true;
 		}
+		if (!strcmp (extension, "chghost"))
+		{
+			strcat (buffer, "chghost ");
+			want_cap = true;
+		}
 
 		/* bouncers can prefix a name space to the extension so we should use.
 		 * znc <= 1.0 uses "znc.in/server-time" and newer use "znc.in/server-time-iso".
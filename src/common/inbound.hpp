@@ -27,7 +27,9 @@ void inbound_next_nick (session *sess, char *nick, int error,
 								const message_tags_data *tags_data);
 void inbound_uback (server &serv, const message_tags_data *tags_data);
 void inbound_uaway (server &serv, const message_tags_data *tags_data);
-void inbound_account (const server &serv, const char *nick, const char *account,
+void inbound_account (server &serv, const char *nick, const char *account,
+							 const message_tags_data *tags_data);
+void inbound_chghost (server &serv, const char *nick, const char *user, const char *host,
 							 const message_tags_data *tags_data);
 void inbound_part (const server &serv, char *chan, char *user, char *ip, char *reason,
 						 const message_tags_data *tags_data);
@@ -70,7 +72,7 @@ bool inbound_nameslist_end (const server &serv, const std::string & chan,
 									const message_tags_data *tags_data);
 void inbound_away (server &serv, char *nick, char *msg,
 						 const message_tags_data *tags_data);
-void inbound_away_notify (const server &serv, char *nick, char *reason,
+void inbound_away_notify (server &serv, char *nick, char *reason,
 								  const message_tags_data *tags_data);
 void inbound_login_start (session *sess, char *nick, char *servname,
 								  const message_tags_data *tags_data);
@@ -27,6 +27,7 @@
 #include <cstdlib>
 #include <cstdio>
 #include <stdexcept>
+#include <vector>
 #include <boost/utility/string_ref.hpp>
 
 #include "hexchat.hpp"
@@ -52,6 +53,8 @@ struct mode_run
 	std::string deop;
 	std::string voice;
 	std::string devoice;
+	/* prefix changes, applied to the userlist once the line is parsed */
+	std::vector<userlist_mode_change> prefix_changes;
 };
 
 static int is_prefix_char (const server * serv, char c);
@@ -401,8 +404,8 @@ handle_single_mode (mode_run &mr, char sign, char mode, char *nick,
 	/* is this a nick mode? */
 	if (serv.nick_modes.find_first_of(mode) != std::string::npos)
 	{
-		/* update the user in the userlist */
-		userlist_update_mode (sess, /*nickname */ arg, mode, sign);
+		/* queue it for the userlist, see handle_mode */
+		mr.prefix_changes.push_back (userlist_mode_change{ arg, mode, sign });
 	} else
 	{
 		if (!is_324 && !sess->ignore_mode && mode_chanmode_type(serv, mode) >= 1)
@@ -754,6 +757,10 @@ handle_mode (server & serv, char *word[], char *word_eol[],
 		modes++;
 	}
 
+	/* move every user whose prefix changed in one go */
+	if (!using_front_tab && !mr.prefix_changes.empty())
+		userlist_update_modes (*sess, mr.prefix_changes);
+
 	/* update the title at the end, now that the mode update is internal now */
 	if (!using_front_tab)
 		fe_set_title (*sess);
@@ -835,6 +842,13 @@ inbound_005 (server & serv, char *word[], const message_tags_data *tags_data)
 			{
 				serv.p_cmp = (int(*)(const char*, const char*))g_ascii_strcasecmp;
 				serv.imbue(std::locale(std::locale(), new ascii_strcasecmp));
+				serv.set_casemapping (casemapping::ascii);
+			} else if (strcmp (word[w] + 12, "strict-rfc1459") == 0)
+			{
+				serv.set_casemapping (casemapping::strict_rfc1459);
+			} else
+			{
+				serv.set_casemapping (casemapping::rfc1459);
 			}
 		} else if (strncmp (word[w], "CHARSET=", 8) == 0)
 		{
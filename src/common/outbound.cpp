@@ -396,11 +396,11 @@ create_mask(session * sess, std::string mask, const std::string &mode, const std
 	std::ostringstream buf;
 
 	user = userlist_find (sess, mask);
-	if (user && user->hostname)  /* it's a nickname, let's find a proper ban mask */
+	if (user && user->info->hostname)  /* it's a nickname, let's find a proper ban mask */
 	{
 		const std::string & p2 = deop ? user->nick : std::string{};
 
-		mask = user->hostname.get();
+		mask = user->info->hostname.get();
 
 		auto at = mask.find_first_of('@'); /* FIXME: utf8 */	
 		if (at == std::string::npos)
@@ -892,6 +892,37 @@ cmd_debug (struct session *sess, char *tbuf, char *word[], char *word_eol[])
 				sess->server->front_session, current_tab);
 	PrintText (sess, tbuf);
 
+	auto mem = userlist_memory_usage ();
+	if (mem.memberships)
+	{
+		sprintf (tbuf,
+					"Users: %lu memberships of %lu nicks, %lu bytes\n"
+					"Bytes per membership: %lu (%lu with per-channel copies)\n\n",
+					(unsigned long) mem.memberships, (unsigned long) mem.nicks,
+					(unsigned long) mem.bytes,
+					(unsigned long) (mem.bytes / mem.memberships),
+					(unsigned long) (mem.copied_bytes / mem.memberships));
+		PrintText (sess, tbuf);
+	}
+
+	auto away = sess->server->away_cache_usage ();
+	sprintf (tbuf,
+				"Away messages: %lu cached, %lu bytes, %lu hits, %lu misses, %lu evicted\n\n",
+				(unsigned long) away.entries, (unsigned long) away.bytes,
+				(unsigned long) away.hits, (unsigned long) away.misses,
+				(unsigned long) away.evictions);
+	PrintText (sess, tbuf);
+
+	auto flood = flood_usage (*sess->server);
+	sprintf (tbuf,
+				"Flood check: %lu CTCPs, %lu messages, %lu hosts tracked (%lu dropped)\n"
+				"Floods: %lu from one host, %lu server-wide, %lu auto-ignores\n\n",
+				(unsigned long) flood.ctcps, (unsigned long) flood.msgs,
+				(unsigned long) flood.sources, (unsigned long) flood.evictions,
+				(unsigned long) flood.source_floods, (unsigned long) flood.server_floods,
+				(unsigned long) flood.auto_ignores);
+	PrintText (sess, tbuf);
+
 	return TRUE;
 }
 
@@ -1290,9 +1321,9 @@ cmd_dns (struct session *sess, char *tbuf, char *word[], char *word_eol[])
 		auto user = userlist_find (sess, nick);
 		if (user)
 		{
-			if (user->hostname)
+			if (user->info->hostname)
 			{
-				do_dns (sess, user->nick.c_str(), user->hostname->c_str(), &no_tags);
+				do_dns (sess, user->nick.c_str(), user->info->hostname->c_str(), &no_tags);
 			} else
 			{
 				sess->server->p_get_ip (nick);
@@ -1748,7 +1779,7 @@ cmd_exportconf (struct session *sess, char *tbuf, char *word[], char *word_eol[]
 static int
 cmd_flushq (struct session *sess, char *tbuf, char *word[], char *word_eol[])
 {
-	PrintTextf(sess, boost::format(_("Flushing server send queue, %d bytes.\n")) % sess->server->sendq_len);
+	PrintTextf(sess, boost::format(_("Flushing server send queue, %d bytes.\n")) % sess->server->outbound_queue.queue_length());
 	sess->server->flush_queue ();
 	return TRUE;
 }
@@ -2425,8 +2456,8 @@ split_up_text(struct session *sess, char *text, int cmd_length, char *split_text
 	max -= cmd_length;
 	max -= strlen (sess->server->nick);
 	max -= strlen (sess->channel);
-	if (sess->me && sess->me->hostname)
-		max -= sess->me->hostname->size();
+	if (sess->me && sess->me->info->hostname)
+		max -= sess->me->info->hostname->size();
 	else
 	{
 		max -= 9;	/* username */
@@ -3542,7 +3573,7 @@ cmd_userlist (struct session *sess, char *, char *[],
 			lt = time(0) - user->lasttalk;
 		PrintTextf(sess,
 			boost::format("\00306%s\t\00314[\00310%-38s\00314] \017ov\0033=\017%d%d away=%u lt\0033=\017%ld\n") %
-			user->nick % (user->hostname ? user->hostname->c_str() : "") % user->op % user->voice % user->away % (long)lt);
+			user->nick % (user->info->hostname ? user->info->hostname->c_str() : "") % static_cast<bool>(user->op) % static_cast<bool>(user->voice) % user->info->away % (long)lt);
 	}
 	return TRUE;
 }
@@ -4196,24 +4227,19 @@ perform_nick_completion (struct session *sess, char *cmd, char *tbuf)
 
 				int bestlen = std::numeric_limits<int>::max();
 				User * best = nullptr;
-				for (auto & user : sess->usertree)
+				for (auto user : userlist_complete (*sess, boost::string_ref (nick, len)))
 				{
-					int lenu;
-
-					if (!rfc_ncasecmp(user->nick.c_str(), nick, len))
+					int lenu = user->nick.size();
+					if (lenu == len)
 					{
-						lenu = user->nick.size();
-						if (lenu == len)
-						{
-							snprintf(tbuf, TBUFSIZE, "%s%s", user->nick.c_str(), space - 1);
-							len = -1;
-							break;
-						}
-						else if (lenu < bestlen)
-						{
-							bestlen = lenu;
-							best = user.get();
-						}
+						snprintf(tbuf, TBUFSIZE, "%s%s", user->nick.c_str(), space - 1);
+						len = -1;
+						break;
+					}
+					else if (lenu < bestlen)
+					{
+						bestlen = lenu;
+						best = user;
 					}
 				}
 
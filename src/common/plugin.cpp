@@ -39,6 +39,7 @@
 #include <boost/format.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/utility/string_ref.hpp>
+#include <message.hpp>
 
 #ifdef WIN32
 #include <io.h>
@@ -516,8 +517,16 @@ int plugin_reload (session *sess, const char *name, bool by_filename)
 
 #endif
 
+/* hook names are NUL terminated, event names may point into a line */
+static bool
+plugin_hook_name_matches (const char *hook_name, const boost::string_ref & name)
+{
+	return g_ascii_strncasecmp (hook_name, name.data(), name.size()) == 0
+		&& hook_name[name.size()] == 0;
+}
+
 static GSList *
-plugin_hook_find (GSList *list, int type, const char *name)
+plugin_hook_find (GSList *list, int type, const boost::string_ref & name)
 {
 	hexchat_hook *hook;
 
@@ -526,7 +535,7 @@ plugin_hook_find (GSList *list, int type, const char *name)
 		hook = static_cast<hexchat_hook*>(list->data);
 		if (hook && (hook->type & type))
 		{
-			if (g_ascii_strcasecmp (hook->name, name) == 0)
+			if (plugin_hook_name_matches (hook->name, name))
 				return list;
 
 			if ((type & HOOK_SERVER)
@@ -542,7 +551,7 @@ plugin_hook_find (GSList *list, int type, const char *name)
 /* check for plugin hooks and run them */
 
 static int
-plugin_hook_run(session *sess, const char *name, const char *const word[], const char *const word_eol[],
+plugin_hook_run(session *sess, const boost::string_ref & name, const char *const word[], const char *const word_eol[],
 				 hexchat_event_attrs *attrs, int type)
 {
 	GSList *list, *next;
@@ -640,14 +649,14 @@ hexchat_event_attrs_free (hexchat_plugin *ph, hexchat_event_attrs *attrs)
 /* got a server PRIVMSG, NOTICE, numeric etc... */
 
 int
-plugin_emit_server (session *sess, char *name, char *word[], char *word_eol[],
+plugin_emit_server (session *sess, const irc::message_view & msg, char *word[], char *word_eol[],
 					time_t server_time)
 {
 	hexchat_event_attrs attrs;
 
 	attrs.server_time_utc = server_time;
 
-	return plugin_hook_run (sess, name, word, word_eol, &attrs, 
+	return plugin_hook_run (sess, msg.command, word, word_eol, &attrs, 
 							HOOK_SERVER | HOOK_SERVER_ATTRS);
 }
 
@@ -1500,15 +1509,15 @@ hexchat_list_str (hexchat_plugin *ph, hexchat_list *xlist, const char *name)
 		switch (hash)
 		{
 		case 0xb9d38a2d: /* account */
-			return ((struct User *)data)->account ? ((struct User *)data)->account->c_str() : nullptr;
+			return ((struct User *)data)->info->account ? ((struct User *)data)->info->account->c_str() : nullptr;
 		case 0x339763: /* nick */
 			return ((struct User *)data)->nick.c_str();
 		case 0x30f5a8: /* host */
-			return ((struct User *)data)->hostname ? ((struct User *)data)->hostname->c_str() : nullptr;
+			return ((struct User *)data)->info->hostname ? ((struct User *)data)->info->hostname->c_str() : nullptr;
 		case 0xc594b292: /* prefix */
 			return ((struct User *)data)->prefix;
 		case 0xccc6d529: /* realname */
-			return ((struct User *)data)->realname ? ((struct User *)data)->realname->c_str() : nullptr;
+			return ((struct User *)data)->info->realname ? ((struct User *)data)->info->realname->c_str() : nullptr;
 		}
 		break;
 	}
@@ -1614,7 +1623,7 @@ hexchat_list_int (hexchat_plugin *ph, hexchat_list *xlist, const char *name)
 		case 0x1916144c: /* maxmodes */
 			return ((struct session *)data)->server->modes_per_line;
 		case 0x66f1911: /* queue */
-			return ((struct session *)data)->server->sendq_len;
+			return ((struct session *)data)->server->outbound_queue.queue_length();
 		case 0x368f3a:	/* type */
 			return ((struct session *)data)->type;
 		case 0x6a68e08: /* users */
@@ -1635,7 +1644,7 @@ hexchat_list_int (hexchat_plugin *ph, hexchat_list *xlist, const char *name)
 		switch (hash)
 		{
 		case 0x2de2ee:	/* away */
-			return ((struct User *)data)->away;
+			return ((struct User *)data)->info->away;
 		case 0x4705f29b: /* selected */
 			return ((struct User *)data)->selected;
 		}
@@ -1741,7 +1750,14 @@ hexchat_send_modes (hexchat_plugin *ph, const char **targets, int ntargets, int
 char *
 hexchat_strip (hexchat_plugin *ph, const char *str, int len, int flags)
 {
-	return g_strdup(strip_color (str, static_cast<strip_flags>(flags)).c_str());
+	if (len == -1)
+		len = strlen (str);
+	if (flags & STRIP_ESCMARKUP)
+		return g_strdup(strip_color (std::string(str, len), static_cast<strip_flags>(flags)).c_str());
+
+	auto out = static_cast<char*>(g_malloc (len + 1));
+	out[strip_color_buf (str, len, static_cast<strip_flags>(flags), out)] = 0;
+	return out;
 }
 
 void
@@ -28,6 +28,11 @@
 typedef struct session hexchat_context;
 #include "hexchat-plugin.h"
 
+namespace irc
+{
+	struct message_view;
+}
+
 typedef int(*plugin_init_func)(hexchat_plugin *plugin_handle, char **plugin_name,
 	char **plugin_desc, char **plugin_version, char *arg);
 typedef int(*plugin_deinit_func)(hexchat_plugin *);
@@ -54,7 +59,7 @@ int plugin_kill (char *name, int by_filename);
 void plugin_kill_all (void);
 void plugin_auto_load (session *sess);
 int plugin_emit_command (session *sess, char *name, char *word[], char *word_eol[]);
-int plugin_emit_server (session *sess, char *name, char *word[], char *word_eol[],
+int plugin_emit_server (session *sess, const irc::message_view & msg, char *word[], char *word_eol[],
 						time_t server_time);
 int plugin_emit_print(session *sess, const char *const word[], time_t server_time);
 int plugin_emit_dummy_print (session *sess, char *name);
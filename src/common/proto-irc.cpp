@@ -22,8 +22,12 @@
 #define WIN32_LEAN_AND_MEAN
 #define NOMINMAX
 #endif
+#include <algorithm>
 #include <cstdint>
+#include <iterator>
+#include <memory>
 #include <string>
+#include <vector>
 #include <cstring>
 #include <cstdio>
 #include <cstdlib>
@@ -35,6 +39,7 @@
 #include <boost/utility/string_ref.hpp>
 #include <boost/algorithm/string/split.hpp>
 #include <boost/algorithm/string/classification.hpp>
+#include <message.hpp>
 
 #ifndef WIN32
 #include <unistd.h>
@@ -42,6 +47,7 @@
 
 #include "hexchat.hpp"
 #include "proto-irc.hpp"
+#include "command_table.hpp"
 #include "ctcp.hpp"
 #include "fe.hpp"
 #include "ignore.hpp"
@@ -1060,319 +1066,364 @@ process_numeric (session * sess, int n,
 	}
 }
 
-namespace {
-	BOOST_CONSTEXPR std::uint32_t
-		wordl(std::uint8_t c0, std::uint8_t c1, std::uint8_t c2, std::uint8_t c3)
-	{
-		return static_cast<std::uint32_t>(c0 | (c1 << 8) | (c2 << 16) | (c3 << 24));
-	}
-}
+/* everything a named message handler gets to work with */
+struct named_message
+{
+	server &serv;
+	session *sess;
+	char **word;
+	char **word_eol;
+	char *nick;
+	char *ip;
+	const message_tags_data *tags_data;
+};
 
-#ifdef BOOST_NO_CONSTEXPR
-/* force a 32bit CMP.L */
-#define WORDL(c0, c1, c2, c3) (std::uint32_t)(c0 | (c1 << 8) | (c2 << 16) | (c3 << 24))
-#else
-#define WORDL wordl
-#endif
+static void
+irc_account (const named_message &m)
+{
+	inbound_account (m.serv, m.nick, m.word[3], m.tags_data);
+}
 
-/* handle named messages that starts with a ':' */
+static void
+irc_away (const named_message &m)
+{
+	inbound_away_notify (m.serv, m.nick,
+								(m.word_eol[3][0] == ':') ? m.word_eol[3] + 1 : NULL,
+								m.tags_data);
+}
 
 static void
-process_named_msg (session *sess, char *type, char *word[], char *word_eol[],
-						 const message_tags_data *tags_data)
+irc_cap (const named_message &m)
 {
-	if (!sess->server)
-		throw std::runtime_error("Invalid server reference");
-	server &serv = *(sess->server);
-	char ip[128], nick[NICKLEN];
-	char *text, *ex;
-	int len = strlen (type);
+	char **word = m.word;
+	char **word_eol = m.word_eol;
 
-	/* fill in the "ip" and "nick" buffers */
-	ex = strchr (word[1], '!');
-	if (!ex)							  /* no '!', must be a server message */
+	if (strncasecmp (word[4], "ACK", 3) == 0)
 	{
-		safe_strcpy (ip, word[1]);
-		safe_strcpy (nick, word[1]);
-	} else
+		inbound_cap_ack (m.serv, word[1], 
+							  word[5][0] == ':' ? word_eol[5] + 1 : word_eol[5],
+							  m.tags_data);
+	}
+	else if (strncasecmp (word[4], "LS", 2) == 0)
 	{
-		safe_strcpy (ip, ex + 1);
-		ex[0] = 0;
-		safe_strcpy (nick, word[1]);
-		ex[0] = '!';
+		inbound_cap_ls (m.serv, word[1], 
+							 word[5][0] == ':' ? word_eol[5] + 1 : word_eol[5],
+							 m.tags_data);
 	}
-
-	if (len == 4)
+	else if (strncasecmp (word[4], "NAK", 3) == 0)
 	{
-		std::uint32_t t = wordl((std::uint8_t)type[0], (std::uint8_t)type[1], (std::uint8_t)type[2], (std::uint8_t)type[3]); 	
-		/* this should compile to a bunch of: CMP.L, JE ... nice & fast */
-		switch (t)
-		{
-		case WORDL('J','O','I','N'):
-			{
-				char *chan = word[3];
-				char *account = word[4];
-				char *realname = word_eol[5];
-
-				if (account && strcmp (account, "*") == 0)
-					account = NULL;
-				if (realname && *realname == ':')
-					realname++;
-				if (*chan == ':')
-					chan++;
-				if (!serv.p_cmp (nick, serv.nick))
-					inbound_ujoin (serv, chan, nick, ip, tags_data);
-				else
-					inbound_join (serv, chan, nick, ip, account, realname,
-									  tags_data);
-			}
-			return;
+		inbound_cap_nak (m.serv, m.tags_data);
+	}
+	else if (strncasecmp (word[4], "LIST", 4) == 0)	
+	{
+		inbound_cap_list (m.serv, word[1], 
+								word[5][0] == ':' ? word_eol[5] + 1 : word_eol[5],
+								m.tags_data);
+	}
+}
 
-		case WORDL('K','I','C','K'):
-			{
-				char *kicked = word[4];
-				char *reason = word_eol[5];
-				if (*kicked)
-				{
-					if (*reason == ':')
-						reason++;
-					if (!strcmp (kicked, serv.nick))
-						inbound_ukick (serv, word[3], nick, reason, tags_data);
-					else
-						inbound_kick (serv, word[3], kicked, nick, reason, tags_data);
-				}
-			}
-			return;
+static void
+irc_chghost (const named_message &m)
+{
+	inbound_chghost (m.serv, m.nick, m.word[3], m.word[4], m.tags_data);
+}
 
-		case WORDL('K','I','L','L'):
-			{
-				char *reason = word_eol[4];
-				if (*reason == ':')
-					reason++;
+static void
+irc_invite (const named_message &m)
+{
+	if (ignore_check(m.word[1], ignore::IG_INVI))
+		return;
 
-				EMIT_SIGNAL_TIMESTAMP (XP_TE_KILL, sess, nick, reason, NULL, NULL,
-											  0, tags_data->timestamp);
-			}
-			return;
+	EMIT_SIGNAL_TIMESTAMP (XP_TE_INVITED, m.sess,
+								  (m.word[4][0] == ':') ? m.word[4] + 1 : m.word[4], m.nick,
+								  m.serv.servername, NULL, 0,
+								  m.tags_data->timestamp);
+}
 
-		case WORDL('M','O','D','E'):
-			handle_mode (serv, word, word_eol, nick, /*numeric_324*/ false, tags_data);	/* modes.c */
-			return;
+static void
+irc_join (const named_message &m)
+{
+	char *chan = m.word[3];
+	char *account = m.word[4];
+	char *realname = m.word_eol[5];
+
+	if (account && strcmp (account, "*") == 0)
+		account = NULL;
+	if (realname && *realname == ':')
+		realname++;
+	if (*chan == ':')
+		chan++;
+	if (!m.serv.p_cmp (m.nick, m.serv.nick))
+		inbound_ujoin (m.serv, chan, m.nick, m.ip, m.tags_data);
+	else
+		inbound_join (m.serv, chan, m.nick, m.ip, account, realname,
+						  m.tags_data);
+}
 
-		case WORDL('N','I','C','K'):
-			inbound_newnick (serv, nick, 
-								  (word_eol[3][0] == ':') ? word_eol[3] + 1 : word_eol[3],
-								  FALSE, tags_data);
-			return;
+static void
+irc_kick (const named_message &m)
+{
+	char *kicked = m.word[4];
+	char *reason = m.word_eol[5];
+	if (*kicked)
+	{
+		if (*reason == ':')
+			reason++;
+		if (!strcmp (kicked, m.serv.nick))
+			inbound_ukick (m.serv, m.word[3], m.nick, reason, m.tags_data);
+		else
+			inbound_kick (m.serv, m.word[3], kicked, m.nick, reason, m.tags_data);
+	}
+}
 
-		case WORDL('P','A','R','T'):
-			{
-				char *chan = word[3];
-				char *reason = word_eol[4];
-
-				if (*chan == ':')
-					chan++;
-				if (*reason == ':')
-					reason++;
-				if (!strcmp (nick, serv.nick))
-					inbound_upart (serv, chan, ip, reason, tags_data);
-				else
-					inbound_part (serv, chan, nick, ip, reason, tags_data);
-			}
-			return;
+static void
+irc_kill (const named_message &m)
+{
+	char *reason = m.word_eol[4];
+	if (*reason == ':')
+		reason++;
 
-		case WORDL('P','O','N','G'):
-			inbound_ping_reply (serv.server_session,
-									  (word[4][0] == ':') ? word[4] + 1 : word[4],
-									  word[3], tags_data);
-			return;
+	EMIT_SIGNAL_TIMESTAMP (XP_TE_KILL, m.sess, m.nick, reason, NULL, NULL,
+								  0, m.tags_data->timestamp);
+}
 
-		case WORDL('Q','U','I','T'):
-			inbound_quit (serv, nick, ip,
-							  (word_eol[3][0] == ':') ? word_eol[3] + 1 : word_eol[3],
-							  tags_data);
-			return;
+static void
+irc_mode (const named_message &m)
+{
+	handle_mode (m.serv, m.word, m.word_eol, m.nick, /*numeric_324*/ false, m.tags_data);	/* modes.c */
+}
 
-		case WORDL('A','W','A','Y'):
-			inbound_away_notify (serv, nick,
-										(word_eol[3][0] == ':') ? word_eol[3] + 1 : NULL,
-										tags_data);
-			return;
-		}
+static void
+irc_nick (const named_message &m)
+{
+	inbound_newnick (m.serv, m.nick, 
+						  (m.word_eol[3][0] == ':') ? m.word_eol[3] + 1 : m.word_eol[3],
+						  FALSE, m.tags_data);
+}
+
+static void
+irc_notice (const named_message &m)
+{
+	server &serv = m.serv;
+	int id = FALSE;								/* identified */
+
+	char *text = m.word_eol[4];
+	if (*text == ':')
+	{
+		text++;
+	}
 
-		goto garbage;
+#ifdef USE_OPENSSL
+	if (!strncmp (text, "CHALLENGE ", 10))		/* QuakeNet CHALLENGE upon our request */
+	{
+		auto response = challengeauth_response (serv.network->user ? serv.network->user : prefs.hex_irc_user_name, serv.password, m.word[5]);
+
+		tcp_sendf (serv, "PRIVMSG %s :CHALLENGEAUTH %s %s %s\r\n",
+			CHALLENGEAUTH_NICK,
+			serv.network->user ? serv.network->user : prefs.hex_irc_user_name,
+			response.c_str(),
+			CHALLENGEAUTH_ALGO);
+		return;									/* omit the CHALLENGE <hash> ALGOS message */
 	}
+#endif
 
-	else if (len >= 5)
+	if (serv.have_idmsg)
 	{
-		std::uint32_t t = wordl((std::uint8_t)type[0], (std::uint8_t)type[1], (std::uint8_t)type[2], (std::uint8_t)type[3]); 	
-		/* this should compile to a bunch of: CMP.L, JE ... nice & fast */
-		switch (t)
+		if (*text == '+')
 		{
+			id = TRUE;
+			text++;
+		} else if (*text == '-')
+			text++;
+	}
 
-		case WORDL('A','C','C','O'):
-			inbound_account (serv, nick, word[3], tags_data);
-			return;
+	if (!ignore_check(m.word[1], ignore::IG_NOTI))
+		inbound_notice (serv, m.word[3], m.nick, text, m.ip, id, m.tags_data);
+}
+
+static void
+irc_part (const named_message &m)
+{
+	char *chan = m.word[3];
+	char *reason = m.word_eol[4];
+
+	if (*chan == ':')
+		chan++;
+	if (*reason == ':')
+		reason++;
+	if (!strcmp (m.nick, m.serv.nick))
+		inbound_upart (m.serv, chan, m.ip, reason, m.tags_data);
+	else
+		inbound_part (m.serv, chan, m.nick, m.ip, reason, m.tags_data);
+}
+
+static void
+irc_pong (const named_message &m)
+{
+	inbound_ping_reply (m.serv.server_session,
+							  (m.word[4][0] == ':') ? m.word[4] + 1 : m.word[4],
+							  m.word[3], m.tags_data);
+}
+
+static void
+irc_privmsg (const named_message &m)
+{
+	server &serv = m.serv;
+	char **word = m.word;
+	char **word_eol = m.word_eol;
+	char *to = word[3];
+	int len;
+	bool id = false;	/* identified */
+	if (*to)
+	{
+		/* Handle limited channel messages, for now no special event */
+		if (serv.chantypes.find_first_of(to[0]) == std::string::npos
+			&& serv.nick_prefixes.find_first_of(to[0]) != std::string::npos)
+			to++;
 			
-		case WORDL('I','N','V','I'):
-			if (ignore_check(word[1], ignore::IG_INVI))
+		char *text = word_eol[4];
+		if (*text == ':')
+			text++;
+		if (serv.have_idmsg)
+		{
+			if (*text == '+')
+			{
+				id = true;
+				text++;
+			} else if (*text == '-')
+				text++;
+		}
+		len = strlen (text);
+		if (text[0] == 1 && text[len - 1] == 1)	/* ctcp */
+		{
+			text[len - 1] = 0;
+			text++;
+			if (g_ascii_strncasecmp (text, "ACTION", 6) != 0 &&
+				!flood_check(m.nick, m.ip, serv, m.sess, flood_check_type::CTCP))
 				return;
-			
-			if (word[4][0] == ':')
-				EMIT_SIGNAL_TIMESTAMP (XP_TE_INVITED, sess, word[4] + 1, nick,
-											  serv.servername, NULL, 0,
-											  tags_data->timestamp);
-			else
-				EMIT_SIGNAL_TIMESTAMP (XP_TE_INVITED, sess, word[4], nick,
-											  serv.servername, NULL, 0,
-											  tags_data->timestamp);
-				
-			return;
-
-		case WORDL('N','O','T','I'):
+			if (g_ascii_strncasecmp (text, "DCC ", 4) == 0)
+				/* redo this with handle_quotes TRUE */
+				process_data_init (word[1], word_eol[1], word, word_eol, true, false);
+			ctcp_handle (m.sess, to, m.nick, m.ip, text, word, word_eol, id,
+							 m.tags_data);
+		} else
+		{
+			if (serv.is_channel_name (to))
 			{
-				int id = FALSE;								/* identified */
-
-				text = word_eol[4];
-				if (*text == ':')
-				{
-					text++;
-				}
+				if (ignore_check(word[1], ignore::IG_CHAN))
+					return;
+				inbound_chanmsg (serv, NULL, to, m.nick, text, false, id,
+									  m.tags_data);
+			} else
+			{
+				if (ignore_check(word[1], ignore::IG_PRIV))
+					return;
+				inbound_privmsg (serv, m.nick, m.ip, text, id, m.tags_data);
+			}
+		}
+	}
+}
 
-#ifdef USE_OPENSSL
-				if (!strncmp (text, "CHALLENGE ", 10))		/* QuakeNet CHALLENGE upon our request */
-				{
-					auto response = challengeauth_response (serv.network->user ? serv.network->user : prefs.hex_irc_user_name, serv.password, word[5]);
-
-					tcp_sendf (serv, "PRIVMSG %s :CHALLENGEAUTH %s %s %s\r\n",
-						CHALLENGEAUTH_NICK,
-						serv.network->user ? serv.network->user : prefs.hex_irc_user_name,
-						response.c_str(),
-						CHALLENGEAUTH_ALGO);
-					return;									/* omit the CHALLENGE <hash> ALGOS message */
-				}
-#endif
+static void
+irc_quit (const named_message &m)
+{
+	inbound_quit (m.serv, m.nick, m.ip,
+					  (m.word_eol[3][0] == ':') ? m.word_eol[3] + 1 : m.word_eol[3],
+					  m.tags_data);
+}
 
-				if (serv.have_idmsg)
-				{
-					if (*text == '+')
-					{
-						id = TRUE;
-						text++;
-					} else if (*text == '-')
-						text++;
-				}
+static void
+irc_topic (const named_message &m)
+{
+	inbound_topicnew (m.serv, m.nick, m.word[3],
+							(m.word_eol[4][0] == ':') ? m.word_eol[4] + 1 : m.word_eol[4],
+							m.tags_data);
+}
 
-				if (!ignore_check(word[1], ignore::IG_NOTI))
-					inbound_notice (serv, word[3], nick, text, ip, id, tags_data);
-			}
-			return;
+static void
+irc_wallops (const named_message &m)
+{
+	char *text = m.word_eol[3];
+	if (*text == ':')
+		text++;
+	EMIT_SIGNAL_TIMESTAMP (XP_TE_WALLOPS, m.sess, m.nick, text, NULL, NULL, 0,
+								  m.tags_data->timestamp);
+}
 
-		case WORDL('P','R','I','V'):
-			{
-				char *to = word[3];
-				int len;
-				bool id = false;	/* identified */
-				if (*to)
-				{
-					/* Handle limited channel messages, for now no special event */
-					if (serv.chantypes.find_first_of(to[0]) == std::string::npos
-						&& serv.nick_prefixes.find_first_of(to[0]) != std::string::npos)
-						to++;
-						
-					text = word_eol[4];
-					if (*text == ':')
-						text++;
-					if (serv.have_idmsg)
-					{
-						if (*text == '+')
-						{
-							id = true;
-							text++;
-						} else if (*text == '-')
-							text++;
-					}
-					len = strlen (text);
-					if (text[0] == 1 && text[len - 1] == 1)	/* ctcp */
-					{
-						text[len - 1] = 0;
-						text++;
-						if (g_ascii_strncasecmp (text, "ACTION", 6) != 0)
-							flood_check(nick, ip, serv, sess, flood_check_type::CTCP);
-						if (g_ascii_strncasecmp (text, "DCC ", 4) == 0)
-							/* redo this with handle_quotes TRUE */
-							process_data_init (word[1], word_eol[1], word, word_eol, true, false);
-						ctcp_handle (sess, to, nick, ip, text, word, word_eol, id,
-										 tags_data);
-					} else
-					{
-						if (serv.is_channel_name (to))
-						{
-							if (ignore_check(word[1], ignore::IG_CHAN))
-								return;
-							inbound_chanmsg (serv, NULL, to, nick, text, false, id,
-												  tags_data);
-						} else
-						{
-							if (ignore_check(word[1], ignore::IG_PRIV))
-								return;
-							inbound_privmsg (serv, nick, ip, text, id, tags_data);
-						}
-					}
-				}
-			}
-			return;
+namespace
+{
+	typedef void (*named_handler)(const named_message &);
 
-		case WORDL('T','O','P','I'):
-			inbound_topicnew (serv, nick, word[3],
-									(word_eol[4][0] == ':') ? word_eol[4] + 1 : word_eol[4],
-									tags_data);
-			return;
+	struct named_command
+	{
+		const char *name;
+		named_handler handler;
+	};
 
-		case WORDL('W','A','L','L'):
-			text = word_eol[3];
-			if (*text == ':')
-				text++;
-			EMIT_SIGNAL_TIMESTAMP (XP_TE_WALLOPS, sess, nick, text, NULL, NULL, 0,
-										  tags_data->timestamp);
-			return;
-		}
+	/* every command that starts with a source; to handle a new one,
+	   write its irc_* handler and add a line here */
+	const named_command named_commands[] =
+	{
+		{ "ACCOUNT", irc_account },
+		{ "AWAY", irc_away },
+		{ "CAP", irc_cap },
+		{ "CHGHOST", irc_chghost },
+		{ "INVITE", irc_invite },
+		{ "JOIN", irc_join },
+		{ "KICK", irc_kick },
+		{ "KILL", irc_kill },
+		{ "MODE", irc_mode },
+		{ "NICK", irc_nick },
+		{ "NOTICE", irc_notice },
+		{ "PART", irc_part },
+		{ "PONG", irc_pong },
+		{ "PRIVMSG", irc_privmsg },
+		{ "QUIT", irc_quit },
+		{ "TOPIC", irc_topic },
+		{ "WALLOPS", irc_wallops },
+	};
+
+	const command_table<named_command> & named_command_table ()
+	{
+		static const command_table<named_command> table (std::begin (named_commands), std::end (named_commands));
+		return table;
 	}
+}
 
-	else if (len == 3)
+/* handle named messages that starts with a ':' */
+
+static void
+process_named_msg (session *sess, char *type, char *word[], char *word_eol[],
+						 const message_tags_data *tags_data)
+{
+	if (!sess->server)
+		throw std::runtime_error("Invalid server reference");
+	server &serv = *(sess->server);
+	char ip[128], nick[NICKLEN];
+	char *ex;
+
+	/* fill in the "ip" and "nick" buffers */
+	ex = strchr (word[1], '!');
+	if (!ex)							  /* no '!', must be a server message */
 	{
-		std::uint32_t t = wordl((std::uint8_t)type[0], (std::uint8_t)type[1], (std::uint8_t)type[2], (std::uint8_t)type[3]);
-		switch (t)
-		{
-			case WORDL('C','A','P','\0'):
-				if (strncasecmp (word[4], "ACK", 3) == 0)
-				{
-					inbound_cap_ack (serv, word[1], 
-										  word[5][0] == ':' ? word_eol[5] + 1 : word_eol[5],
-										  tags_data);
-				}
-				else if (strncasecmp (word[4], "LS", 2) == 0)
-				{
-					inbound_cap_ls (serv, word[1], 
-										 word[5][0] == ':' ? word_eol[5] + 1 : word_eol[5],
-										 tags_data);
-				}
-				else if (strncasecmp (word[4], "NAK", 3) == 0)
-				{
-					inbound_cap_nak (serv, tags_data);
-				}
-				else if (strncasecmp (word[4], "LIST", 4) == 0)	
-				{
-					inbound_cap_list (serv, word[1], 
-											word[5][0] == ':' ? word_eol[5] + 1 : word_eol[5],
-											tags_data);
-				}
+		safe_strcpy (ip, word[1]);
+		safe_strcpy (nick, word[1]);
+	} else
+	{
+		safe_strcpy (ip, ex + 1);
+		ex[0] = 0;
+		safe_strcpy (nick, word[1]);
+		ex[0] = '!';
+	}
 
-				return;
-		}
+	auto command = named_command_table ().find (type);
+	if (command)
+	{
+		named_message m = { serv, sess, word, word_eol, nick, ip, tags_data };
+		command->handler (m);
+		return;
 	}
 
-garbage:
 	/* unknown message */
 	PrintTextTimeStampf (sess, tags_data->timestamp, "GARBAGE: %s\n", word_eol[1]);
 }
@@ -1452,22 +1503,27 @@ get_timezone(void)
  * See http://ircv3.atheme.org/extensions/server-time-3.2
  */
 static void
-handle_message_tag_time (const std::string & time, message_tags_data &tags_data)
+handle_message_tag_time (const boost::string_ref & time_tag, message_tags_data &tags_data)
 {
 	/* The time format defined in the ircv3.2 specification is
 	 *       YYYY-MM-DDThh:mm:ss.sssZ
 	 * but znc simply sends a unix time (with 3 decimal places for miliseconds)
 	 * so we might as well support both.
 	 */
-	if (time.empty())
+	/* sscanf wants a terminated string; anything longer isn't a time */
+	char time[64];
+	if (time_tag.empty() || time_tag.size() >= sizeof(time))
 		return;
-	if (time[time.size() - 1] == 'Z')
+	std::copy (time_tag.begin(), time_tag.end(), time);
+	time[time_tag.size()] = 0;
+
+	if (time[time_tag.size() - 1] == 'Z')
 	{
 		/* as defined in the specification */
 		struct tm t;
 		
 		/* we ignore the milisecond part */
-		auto z = sscanf (time.c_str(), "%d-%d-%dT%d:%d:%d", &t.tm_year, &t.tm_mon, &t.tm_mday,
+		auto z = sscanf (time, "%d-%d-%dT%d:%d:%d", &t.tm_year, &t.tm_mon, &t.tm_mday,
 					&t.tm_hour, &t.tm_min, &t.tm_sec);
 
 		if (z != 6)
@@ -1494,7 +1550,7 @@ handle_message_tag_time (const std::string & time, message_tags_data &tags_data)
 		long long int t;
 
 		/* we ignore the milisecond part */
-		if (sscanf (time.c_str(), "%lld", &t) != 1)
+		if (sscanf (time, "%lld", &t) != 1)
 			return;
 
 		tags_data.timestamp = (time_t) t;
@@ -1506,24 +1562,75 @@ handle_message_tag_time (const std::string & time, message_tags_data &tags_data)
  * See http://ircv3.atheme.org/specification/message-tags-3.2 
  */
 static void
-handle_message_tags (const server &serv, const boost::string_ref & tags_str,
+handle_message_tags (const server &serv, const irc::message_view & msg,
 							message_tags_data &tags_data)
 {
-	/* FIXME We might want to avoid the allocation overhead here since 
-	 * this might be called for every message from the server.
-	 */
-	std::istringstream inbuf{ tags_str.to_string() };
-	for (std::string tag; std::getline(inbuf, tag, ';');)
+	if (!serv.have_server_time)
+		return;
+
+	auto time = msg.tag ("time");
+	if (time)
+		handle_message_tag_time (*time, tags_data);
+}
+
+/* Lay the parsed line out as the word[] and word_eol[] arrays that the
+ * handlers and plugins expect: the source (with its ':') and command, then
+ * every space separated word, so a trailing param is split up as well.
+ * |buf| needs room for two copies of msg.line plus their terminators.
+ */
+static void
+message_words (const irc::message_view & msg, char *buf, char *word[], char *word_eol[])
+{
+	const auto len = msg.line.size ();
+	char *eol = buf;
+	char *words = buf + len + 1;
+	std::copy (msg.line.begin (), msg.line.end (), eol);
+	std::copy (msg.line.begin (), msg.line.end (), words);
+	eol[len] = 0;
+	words[len] = 0;
+
+	std::size_t count = 1;
+	auto add_word = [&](std::size_t offset, std::size_t size)
+	{
+		if (count >= PDIWORDS)
+			return;
+		word[count] = words + offset;
+		word_eol[count] = eol + offset;
+		words[offset + size] = 0;
+		count++;
+	};
+
+	if (!msg.source.empty ())
+		add_word (0, msg.source.size () + 1);
+	add_word (msg.command.data () - msg.line.data (), msg.command.size ());
+
+	for (std::size_t i = 0; i < msg.param_count; ++i)
 	{
-		auto value_loc = tag.find_first_of('=');
-		if (value_loc == std::string::npos)
+		auto offset = msg.param_offset (i);
+		if (i + 1 != msg.param_count)
+		{
+			add_word (offset, msg.params[i].size ());
 			continue;
+		}
 
-		auto key = tag.substr(0, value_loc - 1);
-		auto value = tag.substr(value_loc + 1);
+		/* the last param may hold spaces, one word per run of them */
+		auto end = len;
+		while (offset < end)
+		{
+			auto space = std::find (eol + offset, eol + end, ' ') - eol;
+			add_word (offset, space - offset);
+			offset = space;
+			while (offset < end && eol[offset] == ' ')
+				offset++;
+		}
+	}
 
-		if (serv.have_server_time && key == "time")
-			handle_message_tag_time (value, tags_data);
+	word[0] = "\000\000";
+	word_eol[0] = "\000\000";
+	for (; count < PDIWORDS; count++)
+	{
+		word[count] = "\000\000";
+		word_eol[count] = "\000\000";
 	}
 }
 
@@ -1537,43 +1644,39 @@ server::p_inline (const boost::string_ref& text)
 	char *word_eol[PDIWORDS+1];
 	message_tags_data tags_data = message_tags_data();
 
-	std::string pdibuf(text.size(), '\0');
+	irc::message_view msg;
+	if (!irc::parse (text, msg))
+		return;
+
+	/* the words go on the stack unless the line is far longer than IRC allows */
+	char stack_buf[2048];
+	std::unique_ptr<char[]> heap_buf;
+	char *buf = stack_buf;
+	if (msg.line.size () * 2 + 2 > sizeof (stack_buf))
+	{
+		heap_buf.reset (new char[msg.line.size () * 2 + 2]);
+		buf = heap_buf.get ();
+	}
 
 	sess = this->front_session;
 
 	/* Python relies on this */
 	word[PDIWORDS] = NULL;
 	word_eol[PDIWORDS] = NULL;
-	std::string buf;
-	if (text.starts_with('@'))
-	{
-		auto sep = text.find_first_of(' ');
-		if (sep == boost::string_ref::npos)
-			return;
-		
-		/* skip the '@' */
-		auto tags = text.substr(1, sep - 1);
-		
-		buf = text.substr(sep + 1).to_string();
-
-		handle_message_tags(*this, tags, tags_data);
-	}
-	else
-	{
-		buf = text.to_string();
-	}
 
-	url_check_line(buf.data(), buf.size());
+	handle_message_tags (*this, msg, tags_data);
 
 	/* split line into words and words_to_end_of_line */
-	process_data_init (&pdibuf[0], &buf[0], word, word_eol, false, false);
+	message_words (msg, buf, word, word_eol);
 
-	if (buf[0] == ':')
+	url_check_line (word_eol[1], static_cast<int>(msg.line.size ()));
+
+	if (!msg.source.empty ())
 	{
 		/* find a context for this message */
-		if (this->is_channel_name (word[3]))
+		if (msg.param_count && this->is_channel_name (msg.params[0]))
 		{
-			auto tmp = find_channel (word[3]);
+			auto tmp = find_channel (msg.params[0]);
 			if (tmp)
 				sess = &(*tmp);
 		}
@@ -1582,43 +1685,38 @@ server::p_inline (const boost::string_ref& text)
 		type = word[2];
 
 		word[0] = type;
-		word_eol[1] = &buf[0];	/* keep the ":" for plugins */
+		/* word_eol[1] keeps the ":" for plugins */
 
-		if (plugin_emit_server(sess, type, word, word_eol,
+		if (plugin_emit_server(sess, msg, word, word_eol,
 			tags_data.timestamp))
 		{
 			return;
 		}
 
 		word[1]++;
-		word_eol[1] = &buf[1];	/* but not for HexChat internally */
+		word_eol[1]++;	/* but not for HexChat internally */
 
 	} else
 	{
 		word[0] = type = word[1];
 
-		if (plugin_emit_server(sess, type, word, word_eol,
+		if (plugin_emit_server(sess, msg, word, word_eol,
 			tags_data.timestamp))
 		{
 			return;
 		}
-	}
 
-	if (buf[0] != ':')
-	{
-		process_named_servermsg (sess, &buf[0], word[0], word_eol, &tags_data);
+		process_named_servermsg (sess, word_eol[1], word[0], word_eol, &tags_data);
 		return;
 	}
 
-	/* see if the second word is a numeric */
-	std::locale locale;
-	if (std::isdigit (word[2][0], locale))
+	if (msg.numeric)
 	{
 		char* t = word_eol[4];
 		if (*t == ':')
 			t++;
 
-		process_numeric (sess, atoi (word[2]), word, word_eol, t, &tags_data);
+		process_numeric (sess, msg.numeric, word, word_eol, t, &tags_data);
 	} else
 	{
 		process_named_msg (sess, type, word, word_eol, &tags_data);
@@ -65,6 +65,8 @@
 #include "servlist.hpp"
 #include "server.hpp"
 #include "dcc.hpp"
+#include "ignore.hpp"
+#include "userlist.hpp"
 #include "session.hpp"
 
 
@@ -96,70 +98,126 @@ GSList *serv_list = nullptr;
 extern pxProxyFactory *libproxy_factory;
 #endif
 
-/* actually send to the socket. This might do a character translation or
-   send via SSL. server/dcc both use this function. */
+/* Once connected, the asio reactor only has ready handlers when the
+   connection's socket is readable, or writable while output is queued,
+   so we let the main loop sleep on exactly that instead of polling on a
+   timer. While the name lookup runs we sleep on the pipe libirc's lookup
+   threads write to. The connect attempts and their timers complete
+   through asio's internal wakeup, which no descriptor of ours reflects,
+   so we poll for those. Win32 asio completes through IOCP, which a socket
+   watch can't see, so it always polls. */
 
-int
-tcp_send_real (void *ssl, int sok, const char *encoding, int using_irc, const char *buf, int len, server * serv)
+/* ms between polls while connecting, and on Win32 once connected */
+static const int connecting_poll_ms = 50;
+static const int win32_poll_ms = 20;
+
+static void
+server_remove_io_watch (server &serv)
 {
-	if (!serv->server_connection)
-		return 1; // throw?
+	if (!serv.iotag)
+		return;
 
-	int ret = 0;
-	glib_string locale;
-	gsize loc_len;
+	if (serv.iotag_flags)
+		fe_input_remove (serv.iotag);
+	else
+		fe_timeout_remove (serv.iotag);
+	serv.iotag = 0;
+}
 
-	if (encoding == nullptr)	/* system */
-	{
-		if (!prefs.utf8_locale)
-		{
-			const gchar *charset;
+static void server_update_io_watch (server &serv);
 
-			g_get_charset(&charset);
-			locale.reset(g_convert_with_fallback(buf, len, charset, "UTF-8",
-				"?", 0, &loc_len, 0));
-		}
-	} else
+static gboolean
+server_io_poll (server *serv)
+{
+	if (serv->server_connection)
+		serv->server_connection->poll ();
+	server_update_io_watch (*serv);
+	return TRUE;
+}
+
+static gboolean
+server_io_ready (GIOChannel *source, GIOCondition condition, server *serv)
+{
+	return server_io_poll (serv);
+}
+
+static void
+server_update_io_watch (server &serv)
+{
+	int sok = -1;
+	int flags = 0;
+	bool active = serv.server_connection && (serv.connecting || serv.connected);
+
+#ifndef WIN32
+	if (active && serv.connected)
 	{
-		if (using_irc)	/* using "IRC" encoding (CP1252/UTF-8 hybrid) */
-			/* if all chars fit inside CP1252, use that. Otherwise this
-			   returns NULL and we send UTF-8. */
-			locale.reset(g_convert (buf, len, "CP1252", "UTF-8", 0, &loc_len, 0));
-		else
-			locale.reset(g_convert_with_fallback (buf, len, encoding, "UTF-8",
-														 "?", 0, &loc_len, 0));
+		sok = serv.server_connection->native_handle ();
+		flags = FIA_READ | FIA_EX;
+		if (serv.server_connection->wants_write ())
+			flags |= FIA_WRITE;
 	}
-
-	if (locale)
+	else if (active && serv.server_connection->resolving ())
 	{
-		serv->server_connection->enqueue_message(locale.get());
-#if 0
-		len = loc_len;
-#ifdef USE_OPENSSL
-		if (!ssl)
-			ret = send (sok, locale, len, 0);
-		else
-			ret = _SSL_send (static_cast<SSL*>(ssl), locale, len);
-#else
-		ret = send (sok, locale, len, 0);
-#endif
+		sok = io::tcp::connection::wake_handle ();
+		flags = sok != -1 ? FIA_READ : 0;
+	}
 #endif
-	} else
+
+	if (serv.iotag && active && sok == serv.sok && flags == serv.iotag_flags)
+		return;
+
+	server_remove_io_watch (serv);
+	if (!active)
+		return;
+
+	serv.sok = sok;
+	serv.iotag_flags = flags;
+	if (sok != -1)
+		serv.iotag = fe_input_add (sok, flags, (GIOFunc)server_io_ready, &serv);
+	else
+		serv.iotag = fe_timeout_add (serv.connected ? win32_poll_ms : connecting_poll_ms,
+			(GSourceFunc)server_io_poll, &serv);
+}
+
+/* run handlers queued from outside the reactor (e.g. writes) once we're
+   back in the main loop; poll() must not be re-entered from a handler */
+
+static gboolean
+server_io_flush (server *serv)
+{
+	if (!is_server (serv))
+		return FALSE;
+
+	serv->io_flush_pending = false;
+	if (serv->server_connection)
 	{
-		serv->server_connection->enqueue_message(buf);
-#if 0
-#ifdef USE_OPENSSL
-		if (!ssl)
-			ret = send (sok, buf, len, 0);
-		else
-			ret = _SSL_send (static_cast<SSL*>(ssl), buf, len);
-#else
-		ret = send (sok, buf, len, 0);
-#endif
-#endif
+		serv->server_connection->poll ();
+		server_update_io_watch (*serv);
 	}
+	return FALSE;
+}
 
-	return ret;
+static void
+server_queue_io_flush (server &serv)
+{
+	if (serv.io_flush_pending)
+		return;
+	serv.io_flush_pending = true;
+	fe_idle_add ((GSourceFunc)server_io_flush, &serv);
+}
+
+/* actually send to the socket. The line is converted to the server's
+   encoding first; the connection takes care of SSL. */
+
+int
+tcp_send_real (server &serv, const boost::string_ref & buf)
+{
+	if (!serv.server_connection)
+		return 1; // throw?
+
+	serv.server_connection->enqueue_message (serv.encode_line (buf));
+	server_queue_io_flush (serv);
+	return 0;
 }
 
 static int
@@ -169,8 +227,7 @@ server_send_real (server &serv, const boost::string_ref & buf)
 
 	url_check_line(buf.data(), buf.size());
 
-	return tcp_send_real (serv.ssl, serv.sok, serv.encoding ? serv.encoding->c_str() : nullptr, serv.using_irc,
-		buf.data(), buf.size(), &serv);
+	return tcp_send_real (serv, buf);
 }
 
 /* new throttling system, uses the same method as the Undernet
@@ -184,36 +241,16 @@ tcp_send_queue (server *serv)
 	if (!is_server (serv))
 		return 0;
 
-	const char *p;
-	int  i;
-	time_t now = time(0);
-
-	/* try priority 2,1,0 */
 	while (!serv->outbound_queue.empty())
 	{
-		auto & top = serv->outbound_queue.top();
-
-		if (serv->next_send < now)
-			serv->next_send = now;
-		if (serv->next_send - now >= 10)
-		{
-			/* check for clock skew */
-			if (now >= serv->prev_now)
-				return 1;		  /* don't remove the timeout handler */
-			/* it is skewed, reset to something sane */
-			serv->next_send = now;
-		}
+		auto line = serv->outbound_queue.front();
+		if (!line)
+			return 1;		  /* don't remove the timeout handler */
 
-		for (p = top.second.c_str(), i = top.second.size(); i && *p != ' '; p++, i--){}
+		server_send_real(*serv, *line);
 
-		serv->next_send += (2 + i / 120);
-		serv->sendq_len -= top.second.size();
-		serv->prev_now = now;
+		serv->outbound_queue.pop();
 		fe_set_throttle (serv);
-
-		server_send_real(*serv, top.second);
-
-		serv->outbound_queue.pop(); // = g_slist_remove (serv->outbound_queue, buf);
 	}
 	return 0;						  /* remove the timeout handler */
 }
@@ -226,27 +263,7 @@ tcp_send_len (server &serv, const boost::string_ref & buf)
 	if (!prefs.hex_net_throttle)
 		return server_send_real (serv, buf);
 
-	int priority = 2;	/* pri 2 for most things */
-
-	/* privmsg and notice get a lower priority */
-	if (g_ascii_strncasecmp (buf.data() + 1, "PRIVMSG", 7) == 0 ||
-		 g_ascii_strncasecmp (buf.data() + 1, "NOTICE", 6) == 0)
-	{
-		priority = 1;
-	}
-	else
-	{
-		/* WHO/MODE get the lowest priority */
-		if (g_ascii_strncasecmp(buf.data() + 1, "WHO ", 4) == 0 ||
-		/* but only MODE queries, not changes */
-		(g_ascii_strncasecmp(buf.data() + 1, "MODE", 4) == 0 &&
-			 buf.find_first_of('-') == boost::string_ref::npos &&
-			 buf.find_first_of('+') == boost::string_ref::npos))
-			priority = 0;
-	}
-
-	serv.outbound_queue.emplace(std::make_pair(priority, buf.to_string()));
-	serv.sendq_len += buf.size(); /* tcp_send_queue uses strlen */
+	serv.outbound_queue.push(buf);
 
 	if (tcp_send_queue (&serv) && noqueue)
 		fe_timeout_add(500, (GSourceFunc)tcp_send_queue, &serv);
@@ -290,89 +307,9 @@ close_socket (int sok)
 /* handle 1 line of text received from the server */
 
 static void
-server_inline (server *serv, char *line, size_t len)
+server_inline (server *serv, const boost::string_ref & line)
 {
-	std::string outline;
-	/* Checks whether we're set to use UTF-8 charset */
-	if (serv->using_irc ||				/* 1. using CP1252/UTF-8 Hybrid */
-		(serv->encoding && prefs.utf8_locale) || /* OR 2. using system default->UTF-8 */
-		(!serv->encoding &&				/* OR 3. explicitly set to UTF-8 */
-		 (g_ascii_strcasecmp (serv->encoding->c_str(), "UTF8") == 0 ||
-		  g_ascii_strcasecmp (serv->encoding->c_str(), "UTF-8") == 0)))
-	{
-		/* The user has the UTF-8 charset set, either via /charset
-		command or from his UTF-8 locale. Thus, we first try the
-		UTF-8 charset, and if we fail to convert, we assume
-		it to be ISO-8859-1 (see text_validate). */
-
-		outline = text_validate(boost::string_ref{ line, len });
-
-	} else
-	{
-		/* Since the user has an explicit charset set, either
-		via /charset command or from his non-UTF8 locale,
-		we don't fallback to ISO-8859-1 and instead try to remove
-		errnoeous octets till the string is convertable in the
-		said charset. */
-
-		const char *encoding = nullptr;
-
-		if (serv->encoding)
-			encoding = serv->encoding->c_str();
-		else
-			g_get_charset (&encoding);
-
-		if (encoding != nullptr)
-		{
-			size_t conv_len; /* tells g_convert how much of line to convert */
-			gsize utf_len;
-			gsize read_len;
-			bool retry;
-
-			std::unique_ptr<char[]> conv_line{ new char[len + 1] };
-			std::copy_n(line, len, conv_line.get());
-			conv_line[len] = 0;
-			conv_len = len;
-
-			/* if CP1255, convert it with the NUL terminator.
-				Works around SF bug #1122089 */
-			if (serv->using_cp1255)
-				conv_len++;
-			glib_string utf_line_allocated;
-			do
-			{
-				GError *err = nullptr;
-				retry = false;
-				utf_line_allocated.reset(g_convert_with_fallback (conv_line.get(), conv_len, "UTF-8", encoding, "?", &read_len, &utf_len, &err));
-				if (err != nullptr)
-				{
-					std::unique_ptr<GError, decltype(&g_error_free)> err_ptr(err, g_error_free);
-					if (err->code == G_CONVERT_ERROR_ILLEGAL_SEQUENCE && conv_len > (read_len + 1))
-					{
-						/* Make our best bet by removing the erroneous char.
-						   This will work for casual 8-bit strings with non-standard chars. */
-						std::memmove (conv_line.get() + read_len, conv_line.get() + read_len + 1, conv_len - read_len -1);
-						conv_len--;
-						retry = true;
-					}
-				}
-			} while (retry);
-
-			/* If any conversion has occured at all. Conversion might fail
-			due to errors other than invalid sequences, e.g. unknown charset. */
-			if (utf_line_allocated != nullptr)
-			{
-				if (serv->using_cp1255 && utf_len > 0)
-					utf_len--;
-				outline = std::string{ utf_line_allocated.get(), utf_len };
-			}
-			else
-			{
-				/* If all fails, treat as UTF-8 with fallback to ISO-8859-1. */
-				outline = text_validate(boost::string_ref{ line, len });
-			}
-		}
-	}
+	auto outline = serv->decode_line (line);
 
 	fe_add_rawlog(serv, outline, false);
 
@@ -380,107 +317,11 @@ server_inline (server *serv, char *line, size_t len)
 	serv->p_inline (outline);
 }
 
-/* read data from socket */
-static void 
-server_read_cb(server * serv, const std::string & message, size_t length)
-{
-	for (int i = 0; i < length; ++i)
-	{
-		switch (message[i])
-		{
-		case '\0':
-		case '\r':
-			break;
-
-		case '\n':
-			serv->linebuf[serv->pos] = 0;
-			server_inline(serv, serv->linebuf, serv->pos);
-			serv->pos = 0;
-			break;
-
-		default:
-			serv->linebuf[serv->pos] = message[i];
-			if (serv->pos >= (sizeof(serv->linebuf) - 1))
-				fprintf(stderr,
-				"*** HEXCHAT WARNING: Buffer overflow - shit server!\n");
-			else
-				serv->pos++;
-		}
-	}
-}
-
-static gboolean
-server_read (GIOChannel *source, GIOCondition condition, server *serv)
+/* one line from the connection's read buffer, already without CR LF */
+static void
+server_read_cb (server * serv, const boost::string_ref & line)
 {
-	int sok = serv->sok;
-	int error, i, len;
-	char lbuf[2050];
-
-	while (1)
-	{
-#ifdef USE_OPENSSL
-		if (!serv->ssl)
-#endif
-			len = recv (sok, lbuf, sizeof (lbuf) - 2, 0);
-#ifdef USE_OPENSSL
-		else
-			len = io::ssl::_SSL_recv (serv->ssl, lbuf, sizeof (lbuf) - 2);
-#endif
-		if (len < 1)
-		{
-			error = 0;
-			if (len < 0)
-			{
-				if (would_block ())
-					return TRUE;
-				error = sock_error ();
-			}
-			if (!serv->end_of_motd)
-			{
-				serv->disconnect (serv->server_session, false, error);
-				if (!servlist_cycle (serv))
-				{
-					if (prefs.hex_net_auto_reconnect)
-						serv->auto_reconnect (false, error);
-				}
-			} else
-			{
-				if (prefs.hex_net_auto_reconnect)
-					serv->auto_reconnect (false, error);
-				else
-					serv->disconnect (serv->server_session, false, error);
-			}
-			return TRUE;
-		}
-
-		i = 0;
-
-		lbuf[len] = 0;
-
-		while (i < len)
-		{
-			switch (lbuf[i])
-			{
-			case '\r':
-				break;
-
-			case '\n':
-				serv->linebuf[serv->pos] = 0;
-				server_inline (serv, serv->linebuf, serv->pos);
-				serv->pos = 0;
-				break;
-
-			default:
-				serv->linebuf[serv->pos] = lbuf[i];
-				if (serv->pos >= (sizeof (serv->linebuf) - 1))
-					fprintf (stderr,
-								"*** HEXCHAT WARNING: Buffer overflow - shit server!\n");
-				else
-					serv->pos++;
-			}
-			i++;
-		}
-	}
+	server_inline (serv, line);
 }
 
 static void
@@ -522,44 +363,6 @@ server_connected1(server * serv, const boost::system::error_code & error)
 	fe_server_event(serv, fe_serverevents::CONNECT, 0);
 }
 
-static void
-server_connected (server * serv)
-{
-	prefs.wait_on_exit = TRUE;
-	serv->ping_recv = boost::chrono::steady_clock::now();
-	serv->lag_sent = 0;
-	serv->connected = true;
-	set_nonblocking (serv->sok);
-	serv->iotag = fe_input_add(serv->sok, FIA_READ | FIA_EX, (GIOFunc)server_read, serv);
-	if (!serv->no_login)
-	{
-		EMIT_SIGNAL (XP_TE_CONNECTED, serv->server_session, nullptr, nullptr, nullptr,
-						 nullptr, 0);
-		if (serv->network)
-		{
-			ircnet* net = serv->network;
-			serv->p_login (	(!(net->flags & FLAG_USE_GLOBAL) &&
-								 (net->user)) ?
-								(net->user) :
-								prefs.hex_irc_user_name,
-								(!(net->flags & FLAG_USE_GLOBAL) &&
-								 (net->real)) ?
-								(net->real) :
-								prefs.hex_irc_real_name);
-		} else
-		{
-			serv->p_login (prefs.hex_irc_user_name, prefs.hex_irc_real_name);
-		}
-	} else
-	{
-		EMIT_SIGNAL (XP_TE_SERVERCONNECTED, serv->server_session, nullptr, nullptr,
-						 nullptr, nullptr, 0);
-	}
-
-	serv->set_name (serv->servername);
-	fe_server_event(serv, fe_serverevents::CONNECT, 0);
-}
-
 #ifdef WIN32
 
 static gboolean
@@ -573,14 +376,27 @@ server_close_pipe (int *pipefd)	/* see comments below */
 
 #endif
 
+/* closes the connection and cuts it off from |serv|, so no handler still
+   pending on the io_service can report to it */
+static void
+server_drop_connection (server &serv)
+{
+	auto & conn = serv.server_connection;
+	if (!conn)
+		return;
+	conn->on_connecting.disconnect_all_slots ();
+	conn->on_connect.disconnect_all_slots ();
+	conn->on_valid_connection.disconnect_all_slots ();
+	conn->on_error.disconnect_all_slots ();
+	conn->on_message.disconnect_all_slots ();
+	conn->on_ssl_handshakecomplete.disconnect_all_slots ();
+	conn.reset ();
+}
+
 static void
 server_stopconnecting (server * serv)
 {
-	if (serv->iotag)
-	{
-		fe_input_remove (serv->iotag);
-		serv->iotag = 0;
-	}
+	server_remove_io_watch (*serv);
 
 	if (serv->joindelay_tag)
 	{
@@ -624,7 +440,6 @@ server_stopconnecting (server * serv)
 }
 
 #ifdef USE_OPENSSL
-#define	SSLTMOUT	90				  /* seconds */
 static void
 ssl_cb_info (const SSL * s, int where, int ret)
 {
@@ -755,161 +570,6 @@ ssl_cb_verify (int ok, X509_STORE_CTX * ctx)
 
 	return (TRUE);					  /* always ok */
 }
-
-static int
-ssl_do_connect (server * serv)
-{
-	char buf[128];
-
-	g_sess = serv->server_session;
-	if (SSL_connect (serv->ssl) <= 0)
-	{
-		char err_buf[128];
-		int err;
-
-		g_sess = nullptr;
-		if ((err = ERR_get_error ()) > 0)
-		{
-			ERR_error_string (err, err_buf);
-			snprintf (buf, sizeof (buf), "(%d) %s", err, err_buf);
-			EMIT_SIGNAL (XP_TE_CONNFAIL, serv->server_session, buf, nullptr,
-							 nullptr, nullptr, 0);
-
-			if (ERR_GET_REASON (err) == SSL_R_WRONG_VERSION_NUMBER)
-				PrintText (serv->server_session, _("Are you sure this is a SSL capable server and port?\n"));
-
-			serv->cleanup();
-
-			if (prefs.hex_net_auto_reconnectonfail)
-				serv->auto_reconnect (false, -1);
-
-			return (0);				  /* remove it (0) */
-		}
-	}
-	g_sess = nullptr;
-
-	if (SSL_is_init_finished (serv->ssl))
-	{
-		io::ssl::cert_info cert_info = { 0 };
-		int verify_error;
-
-		if (!io::ssl::get_cert_info (cert_info, serv->ssl))
-		{
-			snprintf (buf, sizeof (buf), "* Certification info:");
-			EMIT_SIGNAL (XP_TE_SSLMESSAGE, serv->server_session, buf, nullptr, nullptr,
-							 nullptr, 0);
-			snprintf (buf, sizeof (buf), "  Subject:");
-			EMIT_SIGNAL (XP_TE_SSLMESSAGE, serv->server_session, buf, nullptr, nullptr,
-							 nullptr, 0);
-			for (int i = 0; cert_info.subject_word[i]; i++)
-			{
-				snprintf (buf, sizeof (buf), "    %s", cert_info.subject_word[i]);
-				EMIT_SIGNAL (XP_TE_SSLMESSAGE, serv->server_session, buf, nullptr, nullptr,
-								 nullptr, 0);
-			}
-			snprintf (buf, sizeof (buf), "  Issuer:");
-			EMIT_SIGNAL (XP_TE_SSLMESSAGE, serv->server_session, buf, nullptr, nullptr,
-							 nullptr, 0);
-			for (int i = 0; cert_info.issuer_word[i]; i++)
-			{
-				snprintf (buf, sizeof (buf), "    %s", cert_info.issuer_word[i]);
-				EMIT_SIGNAL (XP_TE_SSLMESSAGE, serv->server_session, buf, nullptr, nullptr,
-								 nullptr, 0);
-			}
-			snprintf (buf, sizeof (buf), "  Public key algorithm: %s (%d bits)",
-						 cert_info.algorithm, cert_info.algorithm_bits);
-			EMIT_SIGNAL (XP_TE_SSLMESSAGE, serv->server_session, buf, nullptr, nullptr,
-							 nullptr, 0);
-			/*if (cert_info.rsa_tmp_bits)
-			{
-				snprintf (buf, sizeof (buf),
-							 "  Public key algorithm uses ephemeral key with %d bits",
-							 cert_info.rsa_tmp_bits);
-				EMIT_SIGNAL (XP_TE_SSLMESSAGE, serv->server_session, buf, NULL, NULL,
-								 NULL, 0);
-			}*/
-			snprintf (buf, sizeof (buf), "  Sign algorithm %s",
-						 cert_info.sign_algorithm/*, cert_info.sign_algorithm_bits*/);
-			EMIT_SIGNAL (XP_TE_SSLMESSAGE, serv->server_session, buf, nullptr, nullptr,
-							 nullptr, 0);
-			snprintf (buf, sizeof (buf), "  Valid since %s to %s",
-						 cert_info.notbefore, cert_info.notafter);
-			EMIT_SIGNAL (XP_TE_SSLMESSAGE, serv->server_session, buf, nullptr, nullptr,
-							 nullptr, 0);
-		} else
-		{
-			snprintf (buf, sizeof (buf), " * No Certificate");
-			EMIT_SIGNAL (XP_TE_SSLMESSAGE, serv->server_session, buf, nullptr, nullptr,
-							 nullptr, 0);
-		}
-
-		auto info = io::ssl::get_cipher_info (serv->ssl);	/* static buffer */
-		snprintf (buf, sizeof (buf), "* Cipher info:");
-		EMIT_SIGNAL (XP_TE_SSLMESSAGE, serv->server_session, buf, nullptr, nullptr, nullptr,
-						 0);
-		snprintf (buf, sizeof (buf), "  Version: %s, cipher %s (%u bits)",
-					 info.version.c_str(), info.cipher.c_str(),
-					 info.cipher_bits);
-		EMIT_SIGNAL (XP_TE_SSLMESSAGE, serv->server_session, buf, nullptr, nullptr, nullptr,
-						 0);
-
-		verify_error = SSL_get_verify_result (serv->ssl);
-		switch (verify_error)
-		{
-		case X509_V_OK:
-			/* snprintf (buf, sizeof (buf), "* Verify OK (?)"); */
-			/* EMIT_SIGNAL (XP_TE_SSLMESSAGE, serv->server_session, buf, NULL, NULL, NULL, 0); */
-			break;
-		case X509_V_ERR_UNABLE_TO_GET_ISSUER_CERT_LOCALLY:
-		case X509_V_ERR_UNABLE_TO_VERIFY_LEAF_SIGNATURE:
-		case X509_V_ERR_DEPTH_ZERO_SELF_SIGNED_CERT:
-		case X509_V_ERR_SELF_SIGNED_CERT_IN_CHAIN:
-		case X509_V_ERR_CERT_HAS_EXPIRED:
-			if (serv->accept_invalid_cert)
-			{
-				snprintf (buf, sizeof (buf), "* Verify E: %s.? (%d) -- Ignored",
-							 X509_verify_cert_error_string (verify_error),
-							 verify_error);
-				EMIT_SIGNAL (XP_TE_SSLMESSAGE, serv->server_session, buf, nullptr, nullptr,
-								 nullptr, 0);
-				break;
-			}
-		default:
-			snprintf (buf, sizeof (buf), "%s.? (%d)",
-						 X509_verify_cert_error_string (verify_error),
-						 verify_error);
-			EMIT_SIGNAL (XP_TE_CONNFAIL, serv->server_session, buf, nullptr, nullptr,
-							 nullptr, 0);
-
-			serv->cleanup ();
-
-			return (0);
-		}
-
-		server_stopconnecting (serv);
-
-		/* activate gtk poll */
-		server_connected (serv);
-
-		return (0);					  /* remove it (0) */
-	} else
-	{
-		if (serv->ssl->session && serv->ssl->session->time + SSLTMOUT < time (nullptr))
-		{
-			snprintf (buf, sizeof (buf), "SSL handshake timed out");
-			EMIT_SIGNAL (XP_TE_CONNFAIL, serv->server_session, buf, nullptr,
-							 nullptr, nullptr, 0);
-			serv->cleanup (); /* ->connecting = FALSE */
-
-			if (prefs.hex_net_auto_reconnectonfail)
-				serv->auto_reconnect (false, -1);
-
-			return (0);				  /* remove it (0) */
-		}
-
-		return (1);					  /* call it more (1) */
-	}
-}
 #endif
 
 static int
@@ -976,27 +636,16 @@ server::auto_reconnect (bool send_quit, int err)
 void
 server::flush_queue ()
 {
-	decltype(this->outbound_queue) empty;
-	std::swap(this->outbound_queue, empty);
-	this->sendq_len = 0;
+	this->outbound_queue.clear();
 	fe_set_throttle (this);
 }
 
 boost::optional<session&> 
 server::find_channel(const boost::string_ref &chan)
 {
-	session *sess;
-	GSList *list = sess_list;
-	while (list)
-	{
-		sess = static_cast<session*>(list->data);
-		if ((this == sess->server) && sess->type == session::SESS_CHANNEL)
-		{
-			if (!this->p_cmp(chan.data(), sess->channel))
-				return *sess;
-		}
-		list = list->next;
-	}
+	auto sess = ::find_channel (*this, chan);
+	if (sess)
+		return *sess;
 	return boost::none;
 }
 
@@ -1176,12 +825,7 @@ server::cleanup ()
 		this->death_timer = 0;
 	}
 
-	if (this->iotag)
-	{
-		fe_timeout_remove(this->iotag);
-		//fe_input_remove (this->iotag);
-		this->iotag = 0;
-	}
+	server_remove_io_watch (*this);
 
 	if (this->joindelay_tag)
 	{
@@ -1201,6 +845,9 @@ server::cleanup ()
 	if (this->connecting)
 	{
 		server_stopconnecting (this);
+		/* the shared io_service would otherwise go on running its
+		   lookup and attempts, and report them to us */
+		server_drop_connection (*this);
 		/*closesocket (this->sok4);
 		if (this->proxy_sok4 != -1)
 			closesocket (this->proxy_sok4);
@@ -1228,10 +875,7 @@ server::cleanup ()
 		this->recondelay_tag = 0;
 		return cleanup_result::reconnecting;
 	}
-	if (this->server_connection)
-	{
-		this->server_connection.reset();
-	}
+	server_drop_connection (*this);
 
 	return cleanup_result::not_connected;
 	}
@@ -1300,7 +944,6 @@ server::disconnect (session * sess, bool sendquit, int err)
 		list = list->next;
 	}
 
-	serv->pos = 0;
 	serv->motd_skipped = false;
 	serv->no_login = false;
 	serv->servername[0] = 0;
@@ -1822,10 +1465,13 @@ xit:
 }
 #endif
 
-static gboolean
-io_poll(io::tcp::connection * connection){
-	connection->poll();
-	return TRUE;
+static void
+server_connecting (server * serv, const boost::asio::ip::tcp::endpoint & endpoint)
+{
+	const auto ip = endpoint.address().to_string();
+	const auto port = std::to_string(endpoint.port());
+	EMIT_SIGNAL (XP_TE_CONNECT, serv->server_session, serv->hostname, const_cast<char*>(ip.c_str()),
+		const_cast<char*>(port.c_str()), nullptr, 0);
 }
 
 void server_error(server * serv, const boost::system::error_code & error)
@@ -1857,19 +1503,23 @@ server::connect (char *hostname, int port, bool no_login)
 	int read_des[2] = { 0 };
 	//unsigned int pid;
 	session *sess = this->server_session;
-	boost::asio::io_service io_service;
-	auto resolved = io::tcp::resolve_endpoints(io_service, hostname, port);
-	if (resolved.first){
-		server_error(this, resolved.first);
-		return;
-	}
-	this->server_connection = io::tcp::connection::create_connection(this->use_ssl ? io::tcp::connection_security::no_verify : io::tcp::connection_security::none, io_service );
+
+	/* overlap illegal in strncpy */
+	if (hostname != this->hostname)
+		safe_strcpy (this->hostname, hostname, sizeof (this->hostname));
+
+	/* the lookup runs on libirc's lookup threads, which post the result
+	   back to the io_service; each address tried is reported through
+	   on_connecting */
+	EMIT_SIGNAL (XP_TE_SERVERLOOKUP, sess, hostname, nullptr, nullptr, nullptr, 0);
+	this->server_connection = io::tcp::connection::create_connection(this->use_ssl ? io::tcp::connection_security::no_verify : io::tcp::connection_security::none);
+	this->server_connection->on_connecting.connect(std::bind(server_connecting, this, std::placeholders::_1));
 	this->server_connection->on_connect.connect(std::bind(server_connected1, this, std::placeholders::_1));
 	this->server_connection->on_valid_connection.connect([this](const std::string & hostname){ safe_strcpy(this->servername, hostname.c_str()); });
 	this->server_connection->on_error.connect(std::bind(server_error, this, std::placeholders::_1));
-	this->server_connection->on_message.connect(std::bind(server_read_cb, this, std::placeholders::_1, std::placeholders::_2));
+	this->server_connection->on_message.connect(std::bind(server_read_cb, this, std::placeholders::_1));
 	this->server_connection->on_ssl_handshakecomplete.connect(std::bind(ssl_print_cert_info, this, std::placeholders::_1));
-	this->server_connection->connect(resolved.second);
+	this->server_connection->connect(this->hostname, port);
 	
 	this->reset_to_defaults();
 	this->connecting = true;
@@ -1879,7 +1529,7 @@ server::connect (char *hostname, int port, bool no_login)
 	fe_server_event(this, fe_serverevents::CONNECTING, 0);
 	fe_set_away (*this);
 	this->flush_queue ();
-	this->iotag = fe_timeout_add(50, (GSourceFunc)&io_poll, this->server_connection.get());
+	server_update_io_watch (*this);
 #if 0
 #ifdef USE_OPENSSL
 	if (!ctx && this->use_ssl)
@@ -2011,9 +1661,34 @@ void
 server_fill_her_up (server &serv)
 {
 	serv.p_cmp = rfc_casecmp;	/* can be changed by 005 in modes.c */
+	serv.set_casemapping (casemapping::rfc1459);
 	serv.imbue(rfc_locale(std::locale()));
 }
 
+void
+server::set_casemapping (casemapping mapping)
+{
+	auto table = casemap_table (mapping);
+	if (this->casemap == table)
+		return;
+	this->casemap = table;
+
+	/* nick and channel keys were folded with the old table */
+	userlist_rekey (*this);
+	this->away_messages.clear ();
+	this->channels.clear ();
+	this->dialogs.clear ();
+	for (GSList *list = sess_list; list; list = list->next)
+	{
+		auto sess = static_cast<session *>(list->data);
+		if (sess->server == this)
+		{
+			sess->channel_key.clear ();
+			session_index (*sess);
+		}
+	}
+}
+
 void server::imbue(const std::locale& other)
 {
 	this->locale_ = other;
@@ -2033,13 +1708,9 @@ const std::locale & server::current_locale() const
 void
 server::set_encoding (const char *new_encoding)
 {
-	if (this->encoding)
-	{
-		/* can be left as uninitialized to indicate system encoding */
-		this->encoding = boost::optional<std::string>();
-		this->using_cp1255 = false;
-		this->using_irc = false;
-	}
+	/* can be left as uninitialized to indicate system encoding */
+	this->encoding = boost::none;
+	this->using_irc = false;
 
 	if (new_encoding)
 	{
@@ -2050,18 +1721,84 @@ server::set_encoding (const char *new_encoding)
 		if (space != std::string::npos)
 			this->encoding->erase(space);
 
-		/* server_inline() uses these flags */
-		if (!g_ascii_strcasecmp (this->encoding->c_str(), "CP1255") ||
-			!g_ascii_strcasecmp(this->encoding->c_str(), "WINDOWS-1255"))
-			this->using_cp1255 = true;
-		else if (!g_ascii_strcasecmp(this->encoding->c_str(), "IRC"))
+		if (!g_ascii_strcasecmp(this->encoding->c_str(), "IRC"))
 			this->using_irc = true;
 	}
+
+	/* open the converters once here rather than once per line */
+	const char *wire_charset = nullptr;
+	if (this->encoding)
+		wire_charset = this->using_irc ? "CP1252" : this->encoding->c_str();
+	else
+		g_get_charset (&wire_charset);
+
+	this->using_utf8 = !this->using_irc &&
+		(charset::is_utf8 (wire_charset) || (!this->encoding && prefs.utf8_locale));
+	this->ascii_passthrough = charset::ascii_compatible (wire_charset);
+	if (this->using_utf8)
+	{
+		this->inbound_conv = charset::converter();
+		this->outbound_conv = charset::converter();
+	}
+	else
+	{
+		/* "IRC" is received as UTF-8 with an ISO-8859-1 fallback (see
+		   text_validate), so it only needs the outbound half */
+		this->inbound_conv = this->using_irc ? charset::converter()
+			: charset::converter("UTF-8", wire_charset);
+		this->outbound_conv = charset::converter(wire_charset, "UTF-8");
+	}
+}
+
+/* one line from the server to UTF-8 */
+std::string
+server::decode_line (const boost::string_ref & line)
+{
+	if (this->using_irc || this->using_utf8)
+	{
+		/* The user has the UTF-8 charset set, either via /charset
+		command or from his UTF-8 locale. Thus, we first try the
+		UTF-8 charset, and if we fail to convert, we assume
+		it to be ISO-8859-1 (see text_validate). */
+		return text_validate (line);
+	}
+
+	if (this->ascii_passthrough && charset::is_ascii (line))
+		return line.to_string ();
+
+	/* Since the user has an explicit charset set, either
+	via /charset command or from his non-UTF8 locale,
+	we don't fallback to ISO-8859-1 and instead replace
+	erroneous octets so the rest of the line survives. */
+	std::string outline;
+	if (this->inbound_conv.convert (line, outline, "?"))
+		return outline;
+
+	/* Conversion might fail due to errors other than invalid sequences,
+	e.g. unknown charset. If all fails, treat as UTF-8 with fallback
+	to ISO-8859-1. */
+	return text_validate (line);
+}
+
+/* one UTF-8 line to the server's encoding */
+std::string
+server::encode_line (const boost::string_ref & line)
+{
+	if (this->using_utf8 || (this->ascii_passthrough && charset::is_ascii (line)))
+		return line.to_string ();
+
+	/* for "IRC", if all chars fit inside CP1252 use that, otherwise
+	   send UTF-8; everything else gets a '?' for what it can't show */
+	std::string outline;
+	if (this->outbound_conv.convert (line, outline, this->using_irc ? nullptr : "?"))
+		return outline;
+	return line.to_string ();
 }
 
 server::server()
 	:death_timer(0),
 	p_cmp(),
+	casemap(rfc_tolowertab),
 	port(),
 	sok(),					/* is equal to sok4 or sok6 (the one we are using) */
 	sok4(),					/* tcp4 socket */
@@ -2079,29 +1816,22 @@ server::server()
 	childwrite(),
 	childpid(),
 	iotag(),
+	iotag_flags(),
 	recondelay_tag(),				/* reconnect delay timeout */
 	joindelay_tag(),				/* waiting before we send JOIN */
 	hostname(),				/* real ip number */
 	servername(),			/* what the server says is its name */
 	password(),
 	nick(),
-	linebuf(),
-	pos(),								/* current position in linebuf */
 	nickcount(),
 	loginmethod(),
 	modes_per_line(),			/* 6 on undernet, 4 on efnet etc... */
 	network(),						/* points to entry in servlist.c or NULL! */
-	next_send(),						/* cptr->since in ircu */
-	prev_now(),					/* previous now-time */
-	sendq_len(),						/* queue size */
 	lag(),								/* milliseconds */
 	front_session(),	/* front-most window/tab */
 	server_session(),	/* server window/tab */
 	gui(),		  /* initialized by fe_new_server */
-	ctcp_counter(),	  /*flood */
-	ctcp_last_time(),
-	msg_counter(),	  /*counts the msg tab opened in a certain time */
-	msg_last_time(),
+	flood(),
 
 	/*time_t connect_time;*/				/* when did it connect? */
 	lag_sent(),   /* we are still waiting for this ping response*/
@@ -2139,17 +1869,21 @@ server::server()
 	have_except(),	/* ban exemptions +e */
 	have_invite(),	/* invite exemptions +I */
 	have_cert(),	/* have loaded a cert */
-	using_cp1255(), 	/* encoding is CP1255/WINDOWS-1255? */
 	using_irc(),		/* encoding is "IRC" (CP1252/UTF-8 hybrid)? */
+	using_utf8(),		/* no conversion, only validation */
+	ascii_passthrough(),	/* ASCII lines skip the converters */
 	use_who(),			/* whether to use WHO command to get dcc_ip */
 	sasl_mech(),			/* mechanism for sasl auth */
 	sent_saslauth(),	/* have sent AUTHENICATE yet */
-	sent_capend()	/* have sent CAP END yet */
+	sent_capend(),	/* have sent CAP END yet */
+	io_flush_pending()
 #ifdef USE_OPENSSL
 	,use_ssl(),
 	accept_invalid_cert()
 #endif
-{}
+{
+	set_encoding (nullptr);
+}
 
 server::~server(){}
 
@@ -2267,19 +2001,117 @@ server::set_name (const std::string& name)
 	}
 }
 
-boost::optional<const std::pair<bool, std::string>& >
-server::get_away_message(const std::string & nick) const NOEXCEPT
-		{
-	auto res = this->away_map.find(nick);
-	if (res == this->away_map.cend())
+away_cache::away_cache(std::size_t budget)
+	:budget_(budget), bytes_(0), hits_(0), misses_(0), evictions_(0)
+{
+}
+
+/* what an entry costs: the list node, its index slot and the strings */
+std::size_t
+away_cache::entry_bytes(const entry &e)
+{
+	return sizeof(entry) + 2 * sizeof(void*)
+		+ sizeof(std::pair<const boost::string_ref, entry_iterator>) + 2 * sizeof(void*)
+		+ e.key.capacity() + e.msg.second.capacity();
+}
+
+boost::optional<const away_cache::message&>
+away_cache::find(const boost::string_ref & key)
+{
+	auto res = index_.find(key);
+	if (res == index_.end())
+	{
+		++misses_;
 		return boost::none;
-	return boost::make_optional<const std::pair<bool, std::string>&>(res->second);
+	}
+	++hits_;
+	lru_.splice(lru_.begin(), lru_, res->second);
+	return boost::optional<const message&>(res->second->msg);
+}
+
+void
+away_cache::store(const boost::string_ref & key, const boost::optional<std::string>& msg)
+{
+	auto res = index_.find(key);
+	if (res != index_.end())
+	{
+		auto it = res->second;
+		bytes_ -= entry_bytes(*it);
+		it->msg = std::make_pair(static_cast<bool>(msg), msg ? msg.get() : std::string());
+		bytes_ += entry_bytes(*it);
+		lru_.splice(lru_.begin(), lru_, it);
+	}
+	else
+	{
+		lru_.push_front(entry{ key.to_string(), std::make_pair(static_cast<bool>(msg), msg ? msg.get() : std::string()) });
+		index_.emplace(lru_.front().key, lru_.begin());
+		bytes_ += entry_bytes(lru_.front());
+	}
+
+	/* always keep the newest one, however large */
+	while (bytes_ > budget_ && lru_.size() > 1)
+	{
+		auto &victim = lru_.back();
+		bytes_ -= entry_bytes(victim);
+		index_.erase(victim.key);
+		lru_.pop_back();
+		++evictions_;
+	}
+}
+
+void
+away_cache::erase(const boost::string_ref & key)
+{
+	auto res = index_.find(key);
+	if (res == index_.end())
+		return;
+	auto it = res->second;
+	bytes_ -= entry_bytes(*it);
+	index_.erase(res);
+	lru_.erase(it);
+}
+
+void
+away_cache::clear()
+{
+	index_.clear();
+	lru_.clear();
+	bytes_ = 0;
+}
+
+away_cache::stats
+away_cache::usage() const
+{
+	stats result = { lru_.size(), bytes_, hits_, misses_, evictions_ };
+	return result;
+}
+
+boost::optional<const std::pair<bool, std::string>& >
+server::get_away_message(const std::string & nick)
+{
+	casemapped_name key(this->casemap, nick);
+	return this->away_messages.find(key.get());
 }
 
 void
 server::save_away_message(const std::string& nick, const boost::optional<std::string>& message)
-		{
-	this->away_map.insert({ nick, std::make_pair(static_cast<bool>(message), message ? message.get() : "") });
+{
+	casemapped_name key(this->casemap, nick);
+	this->away_messages.store(key.get(), message);
+}
+
+/* the nick is back or gone; whatever we had is stale */
+void
+server::forget_away_message(const boost::string_ref & nick)
+{
+	casemapped_name key(this->casemap, nick);
+	this->away_messages.erase(key.get());
+}
+
+away_cache::stats
+server::away_cache_usage() const
+{
+	return this->away_messages.usage();
 }
 
 void
@@ -22,21 +22,70 @@
 
 extern GSList *serv_list;
 #include <string>
+#include <list>
 #include <utility>
 #include <unordered_map>
+#include <unordered_set>
 #include <chrono>
 #include <locale>
+#include <memory>
 #include <boost/chrono.hpp>
 #include <boost/optional.hpp>
 #include <boost/utility/string_ref_fwd.hpp>
 #include <tcpfwd.hpp>
+#include <throttled_queue.hpp>
+#include "charset_helpers.hpp"
+#include "hilight.hpp"
+#include "util.hpp"
+
+struct network_user;
+class flood_state;
+
+/* Away messages seen in 301 replies and away-notify, keyed by folded nick.
+   Bounded by an estimate of the bytes it holds; the least recently used
+   entries go first. */
+class away_cache
+{
+public:
+	typedef std::pair<bool, std::string> message;
+	struct stats
+	{
+		std::size_t entries;
+		std::size_t bytes;
+		std::size_t hits;
+		std::size_t misses;
+		std::size_t evictions;
+	};
+	static const std::size_t default_budget = 64 * 1024;
+	explicit away_cache(std::size_t budget = default_budget);
+	boost::optional<const message&> find(const boost::string_ref & key);
+	void store(const boost::string_ref & key, const boost::optional<std::string>& msg);
+	void erase(const boost::string_ref & key);
+	void clear();
+	stats usage() const;
+private:
+	struct entry
+	{
+		std::string key;
+		message msg;
+	};
+	typedef std::list<entry>::iterator entry_iterator;
+	static std::size_t entry_bytes(const entry &e);
+	std::list<entry> lru_;	/* most recently used first */
+	std::unordered_map<boost::string_ref, entry_iterator, string_ref_hash> index_;
+	std::size_t budget_;
+	std::size_t bytes_;
+	std::size_t hits_;
+	std::size_t misses_;
+	std::size_t evictions_;
+};
 
 struct server
 {
 private:
 	void reset_to_defaults();
 	int death_timer;
-	std::unordered_map<std::string, std::pair<bool, std::string> > away_map;
+	away_cache away_messages;
 	std::locale locale_;
 	friend server *server_new(void);
 public:
@@ -94,17 +143,30 @@ public:
 	/*	void (*p_set_away)(struct server *);*/
 	bool p_raw(const boost::string_ref & raw);
 	int(*p_cmp)(const char *s1, const char *s2);
+	const unsigned char *casemap;	/* lowercasing table from CASEMAPPING */
+	/* network_user::key -> everyone sharing a channel with us */
+	std::unordered_map<boost::string_ref, std::unique_ptr<network_user>, string_ref_hash> users;
+	std::unordered_set<std::string> servernames;	/* network_user::servername points in here */
+	/* session::channel_key -> channel and dialog tabs, see session_index */
+	std::unordered_map<boost::string_ref, session *, string_ref_hash> channels;
+	std::unordered_map<boost::string_ref, session *, string_ref_hash> dialogs;
+	hilight_matcher hilight;	/* our nick and the extra highlight words */
 	int compare(const boost::string_ref & lhs, const boost::string_ref & rhs) const;
 	const std::locale & current_locale() const;
 
 	void set_name(const std::string& name);
+	void set_casemapping(casemapping mapping);
 	void set_encoding(const char* new_encoding);
+	std::string decode_line(const boost::string_ref & line);
+	std::string encode_line(const boost::string_ref & line);
 	boost::string_ref get_network(bool fallback) const;
 	// BUGBUG return const!!!
 	boost::optional<session&> find_channel(const boost::string_ref &chan);
 	bool is_channel_name(const boost::string_ref &chan) const;
-	boost::optional<const std::pair<bool, std::string>& > get_away_message(const std::string & nick) const NOEXCEPT;
+	boost::optional<const std::pair<bool, std::string>& > get_away_message(const std::string & nick);
 	void save_away_message(const std::string& nick, const boost::optional<std::string>& message);
+	void forget_away_message(const boost::string_ref & nick);
+	away_cache::stats away_cache_usage() const;
 
 
 	int port;
@@ -127,15 +189,14 @@ public:
 	int childwrite;
 	int childpid;
 	int iotag;
+	int iotag_flags;				/* FIA_* flags iotag watches sok with */
 	int recondelay_tag;				/* reconnect delay timeout */
 	int joindelay_tag;				/* waiting before we send JOIN */
 	char hostname[128];				/* real ip number */
 	char servername[128];			/* what the server says is its name */
 	char password[86];
 	char nick[NICKLEN];
-	char linebuf[2048];				/* RFC says 512 chars including \r\n */
 	std::string last_away_reason;
-	int pos;								/* current position in linebuf */
 	int nickcount;
 	int loginmethod;					/* see login_types[] */
 
@@ -148,10 +209,7 @@ public:
 
 	ircnet *network;						/* points to entry in servlist.c or NULL! */
 
-	std::priority_queue<std::pair<int, std::string> > outbound_queue;
-	time_t next_send;						/* cptr->since in ircu */
-	time_t prev_now;					/* previous now-time */
-	int sendq_len;						/* queue size */
+	io::irc::throttled_queue outbound_queue;
 	int lag;								/* milliseconds */
 
 	struct session *front_session;	/* front-most window/tab */
@@ -159,11 +217,7 @@ public:
 
 	struct server_gui *gui;		  /* initialized by fe_new_server */
 
-	unsigned int ctcp_counter;	  /*flood */
-	time_t ctcp_last_time;
-
-	unsigned int msg_counter;	  /*counts the msg tab opened in a certain time */
-	time_t msg_last_time;
+	std::unique_ptr<flood_state> flood;	/* created by the first flood_check */
 
 	/*time_t connect_time;*/				/* when did it connect? */
 	unsigned long lag_sent;   /* we are still waiting for this ping response*/
@@ -171,6 +225,8 @@ public:
 	time_t away_time;					/* when we were marked away */
 
 	boost::optional<std::string> encoding;					/* NULL for system */
+	charset::converter inbound_conv;	/* encoding -> UTF-8, set up by set_encoding */
+	charset::converter outbound_conv;	/* UTF-8 -> encoding */
 	GSList *favlist;			/* list of channels & keys to join */
 
 	bool motd_skipped;
@@ -203,11 +259,13 @@ public:
 	bool have_except;	/* ban exemptions +e */
 	bool have_invite;	/* invite exemptions +I */
 	bool have_cert;	/* have loaded a cert */
-	bool using_cp1255;	/* encoding is CP1255/WINDOWS-1255? */
 	bool using_irc;		/* encoding is "IRC" (CP1252/UTF-8 hybrid)? */
+	bool using_utf8;	/* lines go out as they are and are only validated on the way in */
+	bool ascii_passthrough;	/* pure ASCII lines need no conversion either way */
 	bool use_who;			/* whether to use WHO command to get dcc_ip */
 	bool sent_saslauth;	/* have sent AUTHENICATE yet */
 	bool sent_capend;	/* have sent CAP END yet */
+	bool io_flush_pending;	/* an idle poll of server_connection is queued */
 #ifdef USE_OPENSSL
 	bool use_ssl;				  /* is server SSL capable? */
 	bool accept_invalid_cert;/* ignore result of server's cert. verify */
@@ -223,7 +281,7 @@ int tcp_send(server & serv, const char (&buf)[N])
 }
 
 void tcp_sendf (server &serv, const char *fmt, ...) G_GNUC_PRINTF (2, 3);
-int tcp_send_real (void *ssl, int sok, const char *encoding, int using_irc, const char *buf, int len, server *);
+int tcp_send_real (server &serv, const boost::string_ref & buf);
 
 server *server_new (void);
 bool is_server (server *serv);
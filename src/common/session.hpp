@@ -23,10 +23,12 @@
 #include <cstdint>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include "sessfwd.hpp"
 #include "serverfwd.hpp"
 #include "history.hpp"
+#include "util.hpp"
 
 struct session
 {
@@ -55,12 +57,16 @@ struct session
 
 	struct server *server;
 	std::vector<struct User*> usertree_alpha;			/* pure alphabetical tree */
+	std::vector<struct User*> usertree_key;			/* by folded nick, for completion */
 	std::vector<std::unique_ptr<struct User>> usertree;		/* ordered with Ops first */
+	std::unordered_map<boost::string_ref, struct User*, string_ref_hash> usernames;	/* User::key -> user */
+	int usertree_sort;					/* hex_gui_ulist_sort the usertree is ordered by */
 	struct User *me;					/* points to myself in the usertree */
 	char channel[CHANLEN];
 	char waitchannel[CHANLEN];		  /* waiting to join channel (/join sent) */
 	char willjoinchannel[CHANLEN];	  /* will issue /join for this channel */
 	char session_name[CHANLEN];		 /* the name of the session, should not modified */
+	std::string channel_key;		/* channel folded by the casemapping, see session_index */
 	char channelkey[64];			  /* XXX correct max length? */
 	int limit;						  /* channel user limit */
 	int logfd;
@@ -93,6 +99,8 @@ struct session
 
 	int lastact_idx;		/* the sess_list_by_lastact[] index of the list we're in.
 							* For valid values, see defines of LACT_*. */
+	struct session *lastact_prev;	/* neighbours in that list */
+	struct session *lastact_next;
 
 	bool new_data;			/* new data avail? (purple tab) */
 	bool nick_said;		/* your nick mentioned? (blue tab) */
@@ -102,6 +110,7 @@ struct session
 	bool ignore_mode;
 	bool ignore_names;
 	bool end_of_names;
+	bool names_loading;	/* collecting a NAMES reply, the GUI is behind */
 	bool doing_who;		/* /who sent on this channel */
 	bool done_away_check;	/* done checking for away status changes */
 	gtk_xtext_search_flags lastlog_flags;
@@ -60,6 +60,7 @@
 #include "fe.hpp"
 #include "filesystem.hpp"
 #include "server.hpp"
+#include "charset_helpers.hpp"
 #include "util.hpp"
 #include "outbound.hpp"
 #include "hexchatc.hpp"
@@ -625,128 +626,32 @@ static void log_write (session &sess, const std::string & text, time_t ts)
 		write (sess.logfd, "\n", 1);	/* emulate what xtext would display */
 }
 
-/* converts a CP1252/ISO-8859-1(5) hybrid to UTF-8                           */
-/* Features: 1. It never fails, all 00-FF chars are converted to valid UTF-8 */
-/*           2. Uses CP1252 in the range 80-9f because ISO doesn't have any- */
-/*              thing useful in this range and it helps us receive from mIRC */
-/*           3. The five undefined chars in CP1252 80-9f are replaced with   */
-/*              ISO-8859-15 control codes.                                   */
-/*           4. Handles 0xa4 as a Euro symbol ala ISO-8859-15.               */
-/*           5. Uses ISO-8859-1 (which matches CP1252) for everything else.  */
-/*           6. This routine measured 3x faster than g_convert :)            */
-
 static std::string iso_8859_1_to_utf8 (const boost::string_ref & in)
 {
-	typedef std::basic_ostringstream<unsigned char> utf8ostringstream;
-	//unsigned char *res, *output;
-	static const unsigned short lowtable[] = /* 74 byte table for 80-a4 */
-	{
-	/* compressed utf-8 table: if the first byte's 0x20 bit is set, it
-	   indicates a 2-byte utf-8 sequence, otherwise prepend a 0xe2. */
-		0x82ac, /* 80 Euro. CP1252 from here on... */
-		0xe281, /* 81 NA */
-		0x809a, /* 82 */
-		0xe692, /* 83 */
-		0x809e, /* 84 */
-		0x80a6, /* 85 */
-		0x80a0, /* 86 */
-		0x80a1, /* 87 */
-		0xeb86, /* 88 */
-		0x80b0, /* 89 */
-		0xe5a0, /* 8a */
-		0x80b9, /* 8b */
-		0xe592, /* 8c */
-		0xe28d, /* 8d NA */
-		0xe5bd, /* 8e */
-		0xe28f, /* 8f NA */
-		0xe290, /* 90 NA */
-		0x8098, /* 91 */
-		0x8099, /* 92 */
-		0x809c, /* 93 */
-		0x809d, /* 94 */
-		0x80a2, /* 95 */
-		0x8093, /* 96 */
-		0x8094, /* 97 */
-		0xeb9c, /* 98 */
-		0x84a2, /* 99 */
-		0xe5a1, /* 9a */
-		0x80ba, /* 9b */
-		0xe593, /* 9c */
-		0xe29d, /* 9d NA */
-		0xe5be, /* 9e */
-		0xe5b8, /* 9f */
-		0xe2a0, /* a0 */
-		0xe2a1, /* a1 */
-		0xe2a2, /* a2 */
-		0xe2a3, /* a3 */
-		0x82ac  /* a4 ISO-8859-15 Euro. */
-	};
-
-	auto len = in.size();
-	const unsigned char* text = reinterpret_cast<const unsigned char*>(in.data());
-
 	/* worst case scenario: every byte turns into 3 bytes */
-	utf8ostringstream output_stream;
-	std::ostream_iterator<unsigned char, unsigned char> output(output_stream);
-	while (len)
-	{
-		if (G_LIKELY (*text < 0x80))
-		{
-			*output = *text;	/* ascii maps directly */
-		}
-		else if (*text <= 0xa4)	/* 80-a4 use a lookup table */
-		{
-			auto idx = *text - 0x80;
-			if (lowtable[idx] & 0x2000)
-			{
-				*output++ = (lowtable[idx] >> 8) & 0xdf; /* 2 byte utf-8 */
-				*output = lowtable[idx] & 0xff;
-			}
-			else
-			{
-				*output++ = 0xe2;	/* 3 byte utf-8 */
-				*output++ = (lowtable[idx] >> 8) & 0xff;
-				*output = lowtable[idx] & 0xff;
-			}
-		}
-		else if (*text < 0xc0)
-		{
-			*output++ = 0xc2;
-			*output = *text;
-		}
-		else
-		{
-			*output++ = 0xc3;
-			*output = *text - 0x40;
-		}
-		output++;
-		text++;
-		len--;
-	}
-	//*output = 0;	/* terminate */
-	auto str = output_stream.str();
-	return std::string{ str.cbegin(), str.cend() };
+	std::string result(in.size() * 3, '\0');
+	if (!result.empty())
+		result.resize(charset::cp1252_to_utf8(in, &result[0]));
+	return result;
 }
 
 // deprecated should be removed as soon as possible... we should be using UTF-8 everywhere
 std::string text_validate(const boost::string_ref & text)
 {
 	/* valid utf8? */
-	if (g_utf8_validate (text.data(), text.size(), 0))
+	if (charset::is_valid_utf8 (text))
 		return text.to_string();
 
-	gsize utf_len;
-	/* fallback to locale */
-	glib_string utf{ g_locale_to_utf8(text.data(), text.size(), 0, &utf_len, NULL) };
-	if (!utf)
-		return iso_8859_1_to_utf8(text);
-
-	if (!utf) 
+	/* fallback to locale, unless the locale is UTF-8 and would fail too */
+	if (!g_get_charset (nullptr))
 	{
-		return "%INVALID%";
-	} 
-	
-	return std::string{ utf.get(), utf_len };
+		gsize utf_len;
+		glib_string utf{ g_locale_to_utf8(text.data(), text.size(), 0, &utf_len, NULL) };
+		if (utf)
+			return std::string{ utf.get(), utf_len };
+	}
+
+	return iso_8859_1_to_utf8(text);
 }
 
 void PrintTextTimeStamp(session *sess, const boost::string_ref & text, time_t timestamp)
@@ -833,7 +738,7 @@ void PrintTextTimeStampf (session *sess, time_t timestamp, const char format[],
 
 /* These lists are thus:
    pntevts_text[] are the strings the user sees (WITH %x etc)
-   pntevts[] are the data strings with \000 etc
+   pntevts[] are the compiled templates
  */
 
 /* To add a new event:
@@ -848,28 +753,17 @@ void PrintTextTimeStampf (session *sess, time_t timestamp, const char format[],
 
    On startup ~/.xchat/printevents.conf is loaded if it doesn't exist the
    defaults are loaded. Any missing events are filled from defaults.
-   Each event is parsed by pevt_build_string and a binary output is produced
-   which looks like:
-
-   (byte) value: 0 = {
-   (int) numbers of bytes
-   (char []) that number of byte to be memcpy'ed into the buffer
-   }
-   1 =
-   (byte) number of variable to insert
-   2 = end of buffer
+   Each event is parsed by pevt_build_string into a pevt_template: the
+   literal text of the format plus a list of ops, each of which is one of
+   literal (a span of that text), arg (the number of the variable to
+   insert) or tab.
 
    Each XP_TE_* signal is hard coded to call text_emit which calls
-   display_event which decodes the data
-
-   This means that this system *should be faster* than snprintf because
-   it always 'knows' that format of the string (basically is preparses much
-   of the work)
-
-   --AGL
+   display_event, which walks the ops and appends straight into one
+   reused buffer; only the arguments are looked at per emit.
  */
 std::array<std::string, NUM_XP> pntevts_text;
-std::array<std::string, NUM_XP> pntevts;
+std::array<pevt_template, NUM_XP> pntevts;
 
 #define pevt_generic_none_help nullptr
 
@@ -1633,120 +1527,88 @@ void load_text_events ()
 */
 #define ARG_FLAG(argn) (1 << (argn))
 
-void format_event (session *sess, int index, char **args, char *dst, size_t dstsize, unsigned int stripcolor_args)
+void format_event (session *sess, int index, const char * const args[], std::string & dst, unsigned int stripcolor_args)
 {
-	if (index < 0 || index > sizeof(pntevts))
+	if (index < 0 || index >= NUM_XP)
 		throw std::invalid_argument("Invalid index");
-	int len, output_index, input_index, numargs;
-	bool done_all = false;
 
-	const std::string& display_evt = pntevts[index];
-	numargs = te[index].num_args & 0x7f;
+	const pevt_template & display_evt = pntevts[index];
+	int numargs = te[index].num_args & 0x7f;
 
-	output_index = input_index = len = 0;
-	dst[0] = 0;
-
-	if (display_evt.empty())
+	dst.clear();
+	if (display_evt.ops.empty())
 		return;
 
-	while (!done_all)
+	for (const auto & op : display_evt.ops)
 	{
-		char d = display_evt[input_index++];
-		switch (d)
+		switch (op.kind)
 		{
-		case 0:
-			memcpy (&len, &(display_evt[input_index]), sizeof (int));
-			input_index += sizeof (int);
-			if (output_index + len > dstsize)
-			{
-				fprintf(stderr, "Overflow in display_event (%s)\n", display_evt.c_str());
-				dst[0] = 0;
-				return;
-			}
-			memcpy(&(dst[output_index]), &(display_evt[input_index]), len);
-			output_index += len;
-			input_index += len;
+		case pevt_op::literal:
+			dst.append(display_evt.text, op.offset, op.len);
 			break;
-		case 1:
+		case pevt_op::arg:
 		{
-			char arg_idx = display_evt[input_index++];
-			if (arg_idx > numargs)
+			if (op.index > numargs)
 			{
 				PrintTextf(sess,
 							"HexChat DEBUG: display_event: arg > numargs (%d %d %s)\n",
-					arg_idx, numargs, display_evt.c_str());
+					op.index, numargs, pntevts_text[index].c_str());
 				break;
 			}
-			const char* current_argument = args[(int)arg_idx + 1];
+			const char* current_argument = args[op.index + 1];
 			if (current_argument == NULL)
-			{
-				PrintTextf(sess, "arg[%d] is NULL in print event\n", arg_idx + 1);
-			}
+				PrintTextf(sess, "arg[%d] is NULL in print event\n", op.index + 1);
+			else if (stripcolor_args & ARG_FLAG(op.index + 1))
+				strip_color2(current_argument, STRIP_ALL, dst);
 			else
-			{
-				std::string mutable_argument(current_argument);
-				if (mutable_argument.size() > dstsize - output_index - 4)
-					mutable_argument = mutable_argument.substr(0, dstsize - output_index - 4);
-					//current_argument[dstsize - output_index - 4] = 0;	/* Avoid buffer overflow */
-				if (stripcolor_args & ARG_FLAG(arg_idx + 1)){ 
-					auto result = strip_color2(mutable_argument, STRIP_ALL);
-					std::copy(result.cbegin(), result.cend(), &dst[output_index]);
-					len = result.size();
-				}
-				else len = strip_hidden_attribute(mutable_argument, &dst[output_index]);
-				output_index += len;
-			}
-			}
+				strip_hidden_attribute(current_argument, dst);
 			break;
-		case 2:
-			dst[output_index++] = '\n';
-			dst[output_index++] = 0;
-			done_all = true;
-			continue;
-		case 3:
-				if (prefs.hex_text_indent)
-					dst[output_index++] = '\t';
-				else
-					dst[output_index++] = ' ';
+		}
+		case pevt_op::tab:
+			dst.push_back(prefs.hex_text_indent ? '\t' : ' ');
 			break;
 		}
 	}
-	dst[output_index] = 0;
-	if (*dst == '\n')
-		dst[0] = 0;
+	dst.push_back('\n');
+	if (dst[0] == '\n')
+		dst.clear();
 }
 
-static void display_event (session *sess, int event, char **args, 
+static void display_event (session *sess, int event, const char * const args[],
 					unsigned int stripcolor_args, time_t timestamp)
 {
-	char buf[4096];
-	format_event (sess, event, args, buf, sizeof (buf), stripcolor_args);
-	if (buf[0])
+	/* reused between events; a nested emit finds it taken and uses its own */
+	static std::string spare;
+	std::string buf;
+	buf.swap(spare);
+	format_event (sess, event, args, buf, stripcolor_args);
+	if (!buf.empty())
 		PrintTextTimeStamp (sess, buf, timestamp);
+	buf.clear();
+	if (buf.capacity() > spare.capacity())
+		buf.swap(spare);
 }
 
-namespace
-{
-	struct pevt_stage1
-	{
-		int len;
-		char *data;
-		struct pevt_stage1 *next;
-	};
-} // end anonymous namespace
-
-int pevt_build_string(const std::string& input, std::string & output, int &max_arg)
+int pevt_build_string(const std::string& input, pevt_template & output, int &max_arg)
 {
-	std::vector<std::vector<char>> events;
-	int clen;
-	char o[4096], d;
-	int output_index, max = -1, x;
+	pevt_template result;
+	char o[64], d;
+	int max = -1, x;
+	std::size_t literal_start = 0;
 
 	std::string buf = check_special_chars (input, true);
 
-	auto len = buf.size();
+	/* ends the literal span collected since the last $ sequence */
+	auto flush_literal = [&]()
+	{
+		if (result.text.size() > literal_start)
+		{
+			pevt_op op = { pevt_op::literal, 0, literal_start, result.text.size() - literal_start };
+			result.ops.push_back(op);
+		}
+		literal_start = result.text.size();
+	};
 
-	clen = output_index = 0;
 	auto input_itr = buf.cbegin();
 	auto end = buf.cend();
 	for (;;)
@@ -1756,24 +1618,15 @@ int pevt_build_string(const std::string& input, std::string & output, int &max_a
 		d = *input_itr++;
 		if (d != '$')
 		{
-			o[output_index++] = d;
+			result.text.push_back(d);
 			continue;
 		}
-		if (*input_itr == '$')
+		if (input_itr != end && *input_itr == '$')
 		{
-			o[output_index++] = '$';
+			result.text.push_back('$');
 			continue;
 		}
-		if (output_index > 0)
-		{
-			std::vector<char> evt(output_index + sizeof(int) + 1);
-			clen += output_index + sizeof (int) + 1;
-			evt[0] = 0;
-			memcpy (&(evt[1]), &output_index, sizeof (int));
-			memcpy (&(evt[1 + sizeof (int)]), o, output_index);
-			output_index = 0;
-			events.emplace_back(std::move(evt));
-		}
+		flush_literal();
 		if (input_itr == end)
 		{
 			fe_message ("String ends with a $", FE_MSG_WARN);
@@ -1799,7 +1652,7 @@ int pevt_build_string(const std::string& input, std::string & output, int &max_a
 			x += d;
 			if (x > 255)
 				goto a_range_error;
-			o[output_index++] = x;
+			result.text.push_back(static_cast<char>(x));
 			continue;
 
 		 a_len_error:
@@ -1811,9 +1664,8 @@ int pevt_build_string(const std::string& input, std::string & output, int &max_a
 		}
 		if (d == 't')
 		{
-			std::vector<char> evt { 3 };
-			events.emplace_back(std::move(evt));
-			clen += 1;
+			pevt_op op = { pevt_op::tab, 0, 0, 0 };
+			result.ops.push_back(op);
 			continue;
 		}
 		if (d < '1' || d > '9')
@@ -1825,36 +1677,14 @@ int pevt_build_string(const std::string& input, std::string & output, int &max_a
 		d -= '0';
 		if (max < d)
 			max = d;
-		std::vector<char> evt{ 1, static_cast<char>(d - 1)  };
-		clen += 2;
-		events.emplace_back(std::move(evt));
-	}
-	if (output_index > 0)
-	{
-		std::vector<char> evt(output_index + sizeof(int) + 1);
-		clen += output_index + sizeof (int) + 1;
-		evt[0] = 0;
-		memcpy (&(evt[1]), &output_index, sizeof (int));
-		memcpy (&(evt[1 + sizeof (int)]), o, output_index);
-		output_index = 0;
-		events.emplace_back(std::move(evt));
-	}
-
-	std::vector<char>evt{ 2 };
-	events.emplace_back(std::move(evt));
-	clen += 1;
-
-	std::string obuf(clen, '\0');
-	auto o_index = obuf.begin();
-	for (const auto& evt : events)
-	{
-		std::copy(evt.cbegin(), evt.cend(), o_index);
-		o_index += evt.size();
+		pevt_op op = { pevt_op::arg, static_cast<unsigned char>(d - 1), 0, 0 };
+		result.ops.push_back(op);
 	}
+	flush_literal();
 
 	max_arg = max;
 
-	output = std::move(obuf);
+	output = std::move(result);
 	return 0;
 }
 
@@ -1887,17 +1717,14 @@ void text_emit (int index, session *sess, char *a, char *b, char *c, char *d,
 		a = tbuf;
 		stripcolor_args &= ~ARG_FLAG(1);	/* don't strip color from this argument */
 	}
-	std::string empty("\000");
-	std::string name(te[index].name);
-	name.push_back(0);
-	char *word[PDIWORDS] = { 0 };
-	word[0] = &name[0];
-	word[1] = (a ? a : &empty[0]);
-	word[2] = (b ? b : &empty[0]);
-	word[3] = (c ? c : &empty[0]);
-	word[4] = (d ? d : &empty[0]);
+	const char *word[PDIWORDS];
+	word[0] = te[index].name;
+	word[1] = (a ? a : "");
+	word[2] = (b ? b : "");
+	word[3] = (c ? c : "");
+	word[4] = (d ? d : "");
 	for (int i = 5; i < PDIWORDS; i++)
-		word[i] = &empty[0];
+		word[i] = "";
 
 	if (plugin_emit_print (sess, word, timestamp))
 		return;
@@ -20,8 +20,10 @@
 #ifndef HEXCHAT_TEXT_HPP
 #define HEXCHAT_TEXT_HPP
 
+#include <cstddef>
 #include <string>
 #include <ctime>
+#include <vector>
 #include <boost/format/format_fwd.hpp>
 #include <boost/utility/string_ref_fwd.hpp>
 #include "textenums.h"
@@ -40,6 +42,27 @@ struct text_event
 	const char *def;
 };
 
+/* a text event format compiled by pevt_build_string */
+struct pevt_op
+{
+	enum op_kind : unsigned char
+	{
+		literal,	/* copy text[offset, offset + len) */
+		arg,	/* insert argument |index| (0 based) */
+		tab	/* indent separator */
+	};
+	op_kind kind;
+	unsigned char index;
+	std::size_t offset;
+	std::size_t len;
+};
+
+struct pevt_template
+{
+	std::string text;	/* all literal spans, back to back */
+	std::vector<pevt_op> ops;
+};
+
 void scrollback_close (session &sess);
 void scrollback_load (session &sess);
 
@@ -53,7 +76,7 @@ void log_close (session &sess);
 void log_open_or_close (session *sess);
 void load_text_events (void);
 void pevent_save (const char file_name[]);
-int pevt_build_string(const std::string& input, std::string & output, int &max_arg);
+int pevt_build_string(const std::string& input, pevt_template & output, int &max_arg);
 int pevent_load (const char *filename);
 void pevent_make_pntevts (void);
 int text_color_of(const boost::string_ref & name);
@@ -63,7 +86,7 @@ int text_emit_by_name (char *name, session *sess, time_t timestamp,
 					   char *a, char *b, char *c, char *d);
 std::string text_validate (const boost::string_ref &);
 gsize get_stamp_str (const char fmt[], time_t tim, char **ret);
-void format_event (session *sess, int index, char **args, char *dst, size_t dstsize, unsigned int stripcolor_args);
+void format_event (session *sess, int index, const char * const args[], std::string & dst, unsigned int stripcolor_args);
 const char *text_find_format_string (const char name[]);
  
 void sound_play (const boost::string_ref & file, bool quiet);
@@ -24,6 +24,8 @@
 #include <cstdlib>
 #include <cstring>
 #include <memory>
+#include <type_traits>
+#include <vector>
 #include <boost/utility/string_ref.hpp>
 
 #include "hexchat.hpp"
@@ -36,15 +38,103 @@
 #include "userlist.hpp"
 #include "session.hpp"
 
+network_user::network_user()
+	:servername(),
+	away()
+{}
+
+namespace
+{
+	/* a MODE line moving more users than this, and more than a quarter of
+	   the channel, has the frontend rebuild its list instead of moving
+	   each row */
+	const std::size_t userlist_rebuild_min = 16;
+
+	/* Users are all one size and come and go by the thousand, so they are
+	   carved out of blocks and a freed slot is reused before a new block is
+	   taken. Blocks are never given back. */
+	class user_pool
+	{
+		union slot
+		{
+			slot *next;
+			std::aligned_storage<sizeof(User), std::alignment_of<User>::value>::type storage;
+		};
+		enum { block_slots = 1024 };
+		std::vector<std::unique_ptr<slot[]>> blocks_;
+		slot *free_;
+		std::size_t used_;
+	public:
+		user_pool()
+			:free_(), used_()
+		{}
+
+		void *allocate()
+		{
+			if (!free_)
+			{
+				std::unique_ptr<slot[]> block(new slot[block_slots]);
+				for (int i = 0; i < block_slots; ++i)
+				{
+					block[i].next = free_;
+					free_ = &block[i];
+				}
+				blocks_.push_back(std::move(block));
+			}
+			slot *s = free_;
+			free_ = s->next;
+			++used_;
+			return s;
+		}
+
+		void release(void *p)
+		{
+			slot *s = static_cast<slot *>(p);
+			s->next = free_;
+			free_ = s;
+			--used_;
+		}
+
+		std::size_t used() const { return used_; }
+		std::size_t reserved() const { return blocks_.size() * block_slots * sizeof(slot); }
+	};
+
+	/* leaked on purpose: Users may still be freed during exit */
+	user_pool & the_user_pool()
+	{
+		static user_pool *pool = new user_pool;
+		return *pool;
+	}
+} // end anonymous namespace
+
+void *
+User::operator new (std::size_t size)
+{
+	if (size != sizeof(User))
+		return ::operator new(size);
+	return the_user_pool().allocate();
+}
+
+void
+User::operator delete (void *p, std::size_t size)
+{
+	if (!p)
+		return;
+	if (size != sizeof(User))
+		::operator delete(p);
+	else
+		the_user_pool().release(p);
+}
+
 User::User()
-	:lasttalk(),
+	:info(),
+	lasttalk(),
 	access(),	/* axs bit field */
 	prefix(),	/* @ + % */
 	op(),
 	hop(),
 	voice(),
 	me(),
-	away(),
 	selected()
 {}
 
@@ -92,36 +182,176 @@ namespace{
 			return -1 * nick_cmp_az_ops(locale, user1, user2);
 		case 3:
 			return -1 * collate.compare(user1.nick.c_str(), user1.nick.c_str() + user1.nick.size(), user2.nick.c_str(), user2.nick.c_str() + user2.nick.size());
-		default:
-			return -1;
+		default:	/* unsorted: everyone compares equal and stays in join order */
+			return 0;
 		}
 	}
 
 
-	static int userlist_resort(session & sess, const std::string & nick)
+	/* orders usertree entries; takes owning and plain pointers alike */
+	struct usertree_less
 	{
-		std::sort(
-			sess.usertree.begin(),
-			sess.usertree.end(),
-			[&sess](const std::unique_ptr<User> &a, const std::unique_ptr<User> &b)
+		const std::locale & locale;
+		template<typename A, typename B>
+		bool operator()(const A &a, const B &b) const
 		{
-			return nick_cmp(*a, *b, sess.server->current_locale()) < 0;
-		});
+			return nick_cmp(*a, *b, locale) < 0;
+		}
+	};
 
-		std::sort(
-			sess.usertree_alpha.begin(),
-			sess.usertree_alpha.end(),
-			[&sess](const User* a, const User* b){
-			return sess.server->current_locale()(a->nick, b->nick);
-		});
+	struct alpha_less
+	{
+		const std::locale & locale;
+		bool operator()(const User *a, const User *b) const
+		{
+			return locale(a->nick, b->nick);
+		}
+	};
 
-		auto result = std::find_if(
-			sess.usertree.cbegin(),
-			sess.usertree.cend(),
-			[nick, &sess](const std::unique_ptr<User> & ptr){
-			return sess.server->compare(nick, ptr->nick) == 0;
-		});
-		return std::distance(sess.usertree.cbegin(), result);
+	std::string casemapped(const server & serv, const boost::string_ref & nick)
+	{
+		return casemapped_name(serv.casemap, nick).str();
+	}
+
+	/* links a channel User to the server's entry for its nick, creating
+	   the entry on the nick's first channel */
+	network_user & userlist_attach(session & sess, User & user, const boost::string_ref & key)
+	{
+		auto & users = sess.server->users;
+		auto found = users.find(key);
+		network_user * info;
+		if (found != users.end())
+		{
+			info = found->second.get();
+		}
+		else
+		{
+			std::unique_ptr<network_user> entry(new network_user);
+			entry->nick = user.nick;
+			entry->key = key.to_string();
+			info = entry.get();
+			users.emplace(info->key, std::move(entry));
+		}
+		info->channels.emplace_back(&sess, &user);
+		user.info = info;
+		return *info;
+	}
+
+	/* drops the link again; the entry goes with its last channel */
+	void userlist_detach(session & sess, User & user)
+	{
+		auto info = user.info;
+		if (!info)
+			return;
+		user.info = nullptr;
+
+		auto & channels = info->channels;
+		channels.erase(std::remove(channels.begin(), channels.end(),
+			std::make_pair(&sess, &user)), channels.end());
+		if (channels.empty())
+		{
+			sess.server->forget_away_message(info->key);
+			sess.server->users.erase(sess.server->users.find(info->key));
+		}
+	}
+
+	/* both trees are kept sorted, so entries can be found and placed by
+	   binary search; only a change of the sort setting needs a full sort */
+	void userlist_check_sort(session & sess)
+	{
+		if (sess.usertree_sort == prefs.hex_gui_ulist_sort)
+			return;
+		std::stable_sort(sess.usertree.begin(), sess.usertree.end(),
+			usertree_less{ sess.server->current_locale() });
+		sess.usertree_sort = prefs.hex_gui_ulist_sort;
+	}
+
+	/* where |user| sits now; its sort keys must not have changed yet */
+	std::vector<std::unique_ptr<User>>::iterator
+		usertree_find(session & sess, const User * user)
+	{
+		auto range = std::equal_range(sess.usertree.begin(), sess.usertree.end(), user,
+			usertree_less{ sess.server->current_locale() });
+		auto result = std::find_if(range.first, range.second,
+			[user](const std::unique_ptr<User> &u){ return u.get() == user; });
+		if (result != range.second)
+			return result;
+		/* the locale changed under us; fall back to a scan */
+		return std::find_if(sess.usertree.begin(), sess.usertree.end(),
+			[user](const std::unique_ptr<User> &u){ return u.get() == user; });
+	}
+
+	std::vector<User*>::iterator
+		alpha_find(session & sess, const User * user)
+	{
+		alpha_less less{ sess.server->current_locale() };
+		auto range = std::equal_range(sess.usertree_alpha.begin(), sess.usertree_alpha.end(), user, less);
+		auto result = std::find(range.first, range.second, user);
+		if (result != range.second)
+			return result;
+		return std::find(sess.usertree_alpha.begin(), sess.usertree_alpha.end(), user);
+	}
+
+	/* orders usertree_key by the folded nick; takes the key itself too */
+	struct key_less
+	{
+		static boost::string_ref key(const User * user) { return user->info->key; }
+		static boost::string_ref key(const boost::string_ref & key) { return key; }
+		template<typename A, typename B>
+		bool operator()(const A &a, const B &b) const
+		{
+			return key(a) < key(b);
+		}
+	};
+
+	void key_insert(session & sess, User * user)
+	{
+		auto pos = std::upper_bound(sess.usertree_key.begin(), sess.usertree_key.end(), user, key_less());
+		sess.usertree_key.insert(pos, user);
+	}
+
+	/* |user|'s key must still be the one it was filed under */
+	void key_erase(session & sess, User * user)
+	{
+		auto range = std::equal_range(sess.usertree_key.begin(), sess.usertree_key.end(), user, key_less());
+		auto pos = std::find(range.first, range.second, user);
+		if (pos != range.second)
+			sess.usertree_key.erase(pos);
+	}
+
+	/* insert into the usertree, returns the row */
+	int usertree_insert(session & sess, std::unique_ptr<User> user)
+	{
+		usertree_less less{ sess.server->current_locale() };
+		auto pos = std::upper_bound(sess.usertree.begin(), sess.usertree.end(), user, less);
+		pos = sess.usertree.insert(pos, std::move(user));
+		return static_cast<int>(std::distance(sess.usertree.begin(), pos));
+	}
+
+	void alpha_insert(session & sess, User * user)
+	{
+		alpha_less less{ sess.server->current_locale() };
+		auto pos = std::upper_bound(sess.usertree_alpha.begin(), sess.usertree_alpha.end(), user, less);
+		sess.usertree_alpha.insert(pos, user);
+	}
+
+	/* Takes |user| out of the usertree while |change| updates its sort keys
+	   and puts it back where it now belongs. Returns the new row. */
+	template<typename Change>
+	int userlist_reposition(session & sess, User * user, bool alpha_changes, Change change)
+	{
+		userlist_check_sort(sess);
+		auto pos = usertree_find(sess, user);
+		std::unique_ptr<User> owned = std::move(*pos);
+		sess.usertree.erase(pos);
+		if (alpha_changes)
+			sess.usertree_alpha.erase(alpha_find(sess, user));
+
+		change(*user);
+
+		if (alpha_changes)
+			alpha_insert(sess, user);
+		return usertree_insert(sess, std::move(owned));
 	}
 
 	/*
@@ -131,88 +361,132 @@ namespace{
 	static int
 		userlist_insertname(session *sess, std::unique_ptr<User> newuser)
 	{
-		auto result = std::find_if(
-			sess->usertree.cbegin(),
-			sess->usertree.cend(),
-			[sess, &newuser](const std::unique_ptr<User>& a){
-			return sess->server->compare(a->nick, newuser->nick) == 0;
-		});
-		if (result != sess->usertree.cend())
-		{
+		casemapped_name key(sess->server->casemap, newuser->nick);
+		if (sess->usernames.count(key.get()))
+			return -1;
+
+		userlist_check_sort(*sess);
+		User * user = newuser.get();
+		auto & info = userlist_attach(*sess, *user, key.get());
+		sess->usernames.emplace(info.key, user);
+		key_insert(*sess, user);
+		alpha_insert(*sess, user);
+		return usertree_insert(*sess, std::move(newuser));
+	}
+
+	/* like userlist_insertname, but leaves the sorting to userlist_end_load */
+	int
+		userlist_appendname(session *sess, std::unique_ptr<User> newuser)
+	{
+		casemapped_name key(sess->server->casemap, newuser->nick);
+		if (sess->usernames.count(key.get()))
 			return -1;
-		}
 
-		const std::string& nick = newuser->nick;
-		sess->usertree.emplace_back(std::move(newuser));
-		sess->usertree_alpha.emplace_back(sess->usertree.back().get());
-		return userlist_resort(*sess, nick);
+		User * user = newuser.get();
+		auto & info = userlist_attach(*sess, *user, key.get());
+		sess->usernames.emplace(info.key, user);
+		sess->usertree_key.push_back(user);
+		sess->usertree_alpha.push_back(user);
+		sess->usertree.push_back(std::move(newuser));
+		return static_cast<int>(sess->usertree.size()) - 1;
 	}
 } // end anonymous namespace
 
+network_user *
+userlist_lookup (server &serv, const boost::string_ref & name)
+{
+	casemapped_name key(serv.casemap, name);
+	auto result = serv.users.find(key.get());
+	if (result != serv.users.end())
+		return result->second.get();
+
+	return nullptr;
+}
+
 void
-userlist_set_away (struct session *sess, const char nick[], bool away)
+userlist_set_away (server &serv, const char nick[], bool away)
 {
-	auto user = userlist_find (sess, nick);
-	if (user)
+	auto info = userlist_lookup (serv, nick);
+	if (!info || info->away == away)
+		return;
+
+	info->away = away;
+	if (!away)
+		serv.forget_away_message (info->key);
+	for (auto & member : info->channels)
 	{
-		if (user->away != away)
-		{
-			user->away = away;
-			/* rehash GUI */
-			fe_userlist_rehash (sess, user);
-			if (away)
-				fe_userlist_update (sess, user);
-		}
+		/* rehash GUI */
+		fe_userlist_rehash (member.first, member.second);
+		if (away)
+			fe_userlist_update (member.first, member.second);
 	}
 }
 
 void
-userlist_set_account (struct session *sess, const char nick[], const char account[])
+userlist_set_account (server &serv, const char nick[], const char account[])
 {
-	auto user = userlist_find (sess, nick);
-	if (user)
+	auto info = userlist_lookup (serv, nick);
+	if (info)
 	{
 		if (strcmp (account, "*") == 0)
-			user->account = boost::none;
+			info->account = boost::none;
 		else
-			user->account = std::string(account);
-			
+			info->account = std::string(account);
+
 		/* gui doesnt currently reflect login status, maybe later
 		fe_userlist_rehash (sess, user); */
 	}
 }
 
+void
+userlist_set_hostname (server &serv, const char nick[], const char hostname[])
+{
+	auto info = userlist_lookup (serv, nick);
+	if (!info)
+		return;
+
+	info->hostname = std::string(hostname);
+	if (prefs.hex_gui_ulist_show_hosts)
+	{
+		for (auto & member : info->channels)
+			fe_userlist_rehash (member.first, member.second);
+	}
+}
+
 bool
-userlist_add_hostname (struct session *sess, const char nick[], const char hostname[],
+userlist_add_hostname (server &serv, const char nick[], const char hostname[],
 							const char realname[], const char servername[], const char account[], unsigned int away)
 {
-	auto user = userlist_find (sess, nick);
-	if (user)
+	auto info = userlist_lookup (serv, nick);
+	if (info)
 	{
 		bool do_rehash = false;
-		if (!user->hostname && hostname)
+		if (!info->hostname && hostname)
 		{
 			if (prefs.hex_gui_ulist_show_hosts)
 				do_rehash = true;
-			user->hostname = hostname;
+			info->hostname = std::string(hostname);
 		}
-		if (!user->realname && realname && *realname)
-			user->realname = std::string(realname);
-		if (!user->servername && servername)
-			user->servername = std::string(servername);
-		if (!user->account && account && strcmp (account, "0") != 0)
-			user->account = std::string(account);
+		if (!info->realname && realname && *realname)
+			info->realname = std::string(realname);
+		if (!info->servername && servername)
+			info->servername = &*serv.servernames.insert(servername).first;
+		if (!info->account && account && strcmp (account, "0") != 0)
+			info->account = std::string(account);
 		if (away != 0xff)
 		{
 			bool actually_away = !!away;
-			if (user->away != actually_away)
+			if (info->away != actually_away)
 				do_rehash = true;
-			user->away = actually_away;
+			info->away = actually_away;
 		}
 
-		fe_userlist_update (sess, user);
-		if (do_rehash)
-			fe_userlist_rehash (sess, user);
+		for (auto & member : info->channels)
+		{
+			fe_userlist_update (member.first, member.second);
+			if (do_rehash)
+				fe_userlist_rehash (member.first, member.second);
+		}
 
 		return true;
 	}
@@ -222,10 +496,15 @@ userlist_add_hostname (struct session *sess, const char nick[], const char hostn
 void
 userlist_free (session &sess)
 {
+	sess.usernames.clear();
+	for (auto & user : sess.usertree)
+		userlist_detach (sess, *user);
+	sess.usertree_key.clear();
 	sess.usertree_alpha.clear();
 	sess.usertree.clear();
 
 	sess.me = nullptr;
+	sess.names_loading = false;
 
 	sess.ops = 0;
 	sess.hops = 0;
@@ -243,14 +522,10 @@ userlist_clear (session *sess)
 
 struct User * userlist_find(struct session *sess, const boost::string_ref & name)
 {
-	auto result = std::find_if(
-		sess->usertree_alpha.cbegin(),
-		sess->usertree_alpha.cend(),
-		[sess, name](const User* u){
-			return sess->server->compare(name, u->nick) == 0;
-		});
-	if (result != sess->usertree_alpha.cend())
-		return *result;
+	casemapped_name key(sess->server->casemap, name);
+	auto result = sess->usernames.find(key.get());
+	if (result != sess->usernames.end())
+		return result->second;
 
 	return nullptr;
 }
@@ -258,18 +533,9 @@ struct User * userlist_find(struct session *sess, const boost::string_ref & name
 struct User *
 userlist_find_global (struct server *serv, const std::string & name)
 {
-	GSList *list = sess_list;
-	while (list)
-	{
-		session *sess = static_cast<session *>(list->data);
-		if (sess->server == serv)
-		{
-			auto user = userlist_find(sess, name);
-			if (user)
-				return user;
-		}
-		list = list->next;
-	}
+	auto info = userlist_lookup (*serv, name);
+	if (info)
+		return info->channels.front().second;
 	return nullptr;
 }
 
@@ -294,75 +560,120 @@ update_counts (session *sess, struct User *user, char prefix,
 	}
 }
 
-void
-userlist_update_mode (session *sess, const char name[], char mode, char sign)
+/* applies one prefix mode to |user|; returns false if it already had it */
+static bool
+userlist_apply_mode (session &sess, User *user, char mode, char sign)
 {
-	auto result = std::find_if(
-		sess->usertree.begin(),
-		sess->usertree.end(),
-		[sess, name](const std::unique_ptr<User> &u){
-		return sess->server->compare(name, u->nick) == 0;
+	/* which bit number is affected? */
+	char prefix;
+	auto access = mode_access (sess.server, mode, &prefix);
+	bool level = sign == '+';
+	if (level == !!(user->access & (1 << access)))
+		return false;
+
+	userlist_reposition (sess, user, false, [&](User & u)
+	{
+		if (level)
+			u.access |= (1 << access);
+		else
+			u.access &= ~(1 << access);
+
+		/* now what is this users highest prefix? e.g. @ for ops */
+		u.prefix[0] = get_nick_prefix (sess.server, u.access);
 	});
-	if (result == sess->usertree.end())
-		return;
 
-	User * user = result->get();
+	/* update the various counts using the CHANGED prefix only */
+	update_counts (&sess, user, prefix, level, level ? 1 : -1);
+	return true;
+}
 
-	/* which bit number is affected? */
-	char prefix;
-	auto access = mode_access (sess->server, mode, &prefix);
-	bool level = false;
-	int offset = 0;
-	if (sign == '+')
+/* Applies all prefix changes of one MODE line. Each user is moved in the
+   usertree by binary search and then has its frontend row moved; only when
+   a large part of the channel moved at once is the frontend's list rebuilt
+   in one go instead, like at the end of NAMES. */
+void
+userlist_update_modes (session &sess, const std::vector<userlist_mode_change> &changes)
+{
+	userlist_end_load (sess);
+
+	std::vector<User*> moved;
+	for (const auto & change : changes)
 	{
-		level = true;
-		if (!(user->access & (1 << access)))
-		{
-			offset = 1;
-			user->access |= (1 << access);
-		}
-	} else
+		auto user = userlist_find (&sess, change.nick);
+		if (!user || !userlist_apply_mode (sess, user, change.mode, change.sign))
+			continue;
+		if (std::find (moved.begin(), moved.end(), user) == moved.end())
+			moved.push_back (user);
+	}
+	if (moved.empty())
+		return;
+
+	if (moved.size() > userlist_rebuild_min && moved.size() * 4 > sess.usertree.size())
+		fe_userlist_load (sess);
+	else
 	{
-		level = false;
-		if (user->access & (1 << access))
+		for (auto user : moved)
 		{
-			offset = -1;
-			user->access &= ~(1 << access);
+			auto pos = usertree_find (sess, user);
+			fe_userlist_move (&sess, user, static_cast<int>(std::distance (sess.usertree.begin(), pos)));
 		}
 	}
 
-	/* now what is this users highest prefix? e.g. @ for ops */
-	user->prefix[0] = get_nick_prefix (sess->server, user->access);
-
-	/* update the various counts using the CHANGED prefix only */
-	update_counts (sess, user, prefix, level, offset);
-	
-	int pos = userlist_resort(*sess, user->nick);
-
-	/* let GTK move it too */
-	fe_userlist_move (sess, user, pos);
-	fe_userlist_numbers (*sess);
+	fe_userlist_numbers (sess);
 }
 
-bool
-userlist_change(struct session *sess, const std::string & oldname, const std::string & newname)
+/* renames the nick in the directory and in every channel it is on;
+   returns its entry, or nullptr if it shares no channel with us */
+network_user *
+userlist_change (server &serv, const std::string & oldname, const std::string & newname)
 {
-	auto user = std::find_if(
-		sess->usertree.begin(),
-		sess->usertree.end(),
-		[sess, oldname](const std::unique_ptr<User> &u){
-			return sess->server->compare(oldname, u->nick) == 0;
-		});
-	if (user == sess->usertree.end())
-		return false;
+	auto info = userlist_lookup (serv, oldname);
+	if (!info)
+		return nullptr;
 
-	user->get()->nick = newname;
-	User* user_ref = user->get();
-	int pos = userlist_resort(*sess, user_ref->nick);
-	fe_userlist_move(sess, user_ref, pos);
-	fe_userlist_numbers(*sess);
+	/* whoever we still had under the new nick is gone by now */
+	auto stale = userlist_lookup (serv, newname);
+	if (stale && stale != info)
+	{
+		auto channels = stale->channels;
+		for (auto & member : channels)
+			userlist_remove_user (member.first, member.second);
+	}
 
-	return true;
+	/* the nick index is only sorted once a NAMES burst is over */
+	for (auto & member : info->channels)
+		userlist_end_load (*member.first);
+
+	/* every index is keyed by info->key, so unhook them before it changes */
+	for (auto & member : info->channels)
+	{
+		member.first->usernames.erase(info->key);
+		key_erase(*member.first, member.second);
+	}
+	auto found = serv.users.find (info->key);
+	auto owned = std::move (found->second);
+	serv.users.erase (found);
+	serv.forget_away_message (info->key);
+	info->nick = newname;
+	info->key = casemapped (serv, newname);
+	serv.users.emplace (info->key, std::move (owned));
+
+	for (auto & member : info->channels)
+	{
+		auto sess = member.first;
+		auto user = member.second;
+
+		int pos = userlist_reposition(*sess, user, true, [&newname](User & u)
+		{
+			u.nick = newname;
+		});
+		sess->usernames[info->key] = user;
+		key_insert(*sess, user);
+		fe_userlist_move(sess, user, pos);
+		fe_userlist_numbers(*sess);
+	}
+
+	return info;
 }
 
 bool
@@ -379,6 +690,7 @@ userlist_remove (struct session *sess, const char name[])
 void
 userlist_remove_user (struct session *sess, struct User *user)
 {
+	userlist_end_load (*sess);
 	if (user->voice)
 		sess->voices--;
 	if (user->op)
@@ -392,18 +704,12 @@ userlist_remove_user (struct session *sess, struct User *user)
 	if (user == sess->me)
 		sess->me = nullptr;
 
-	sess->usertree_alpha.erase(
-		std::remove(
-			sess->usertree_alpha.begin(),
-			sess->usertree_alpha.end(),
-			user));
-	sess->usertree.erase(
-		std::remove_if(
-			sess->usertree.begin(),
-			sess->usertree.end(),
-			[user](const std::unique_ptr<User>& ptr){
-				return user == ptr.get();
-			}));
+	sess->usernames.erase(user->info->key);
+	key_erase(*sess, user);
+	userlist_detach(*sess, *user);
+	sess->usertree_alpha.erase(alpha_find(*sess, user));
+	userlist_check_sort(*sess);
+	sess->usertree.erase(usertree_find(*sess, user));
 }
 
 void
@@ -424,23 +730,15 @@ userlist_add (struct session *sess, const char name[], const char hostname[],
 		user->prefix[0] = name[0];
 
 	/* add it to our linked list */
-	if (hostname)
-		user->hostname = std::string(hostname);
 	user->nick = (name + prefix_chars);
 	/* is it me? */
 	if (!sess->server->compare (user->nick, sess->server->nick))
 		user->me = true;
-	/* extended join info */
-	if (sess->server->have_extjoin)
-	{
-		if (account && *account)
-			user->account = std::string (account);
-		if (realname && *realname)
-			user->realname = std::string (realname);
-	}
 
 	User * user_ref = user.get();
-	auto row = userlist_insertname (sess, std::move(user));
+	auto row = sess->names_loading ?
+		userlist_appendname (sess, std::move(user)) :
+		userlist_insertname (sess, std::move(user));
 
 	/* duplicate? some broken servers trigger this */
 	if (row == -1)
@@ -448,6 +746,18 @@ userlist_add (struct session *sess, const char name[], const char hostname[],
 		return;
 	}
 
+	auto & info = *user_ref->info;
+	if (hostname)
+		info.hostname = std::string(hostname);
+	/* extended join info */
+	if (sess->server->have_extjoin)
+	{
+		if (account && *account)
+			info.account = std::string (account);
+		if (realname && *realname)
+			info.realname = std::string (realname);
+	}
+
 	sess->total++;
 
 	/* most ircds don't support multiple modechars in front of the nickname
@@ -462,6 +772,10 @@ userlist_add (struct session *sess, const char name[], const char hostname[],
 	if (user_ref->me)
 		sess->me = user_ref;
 
+	/* published by userlist_end_load */
+	if (sess->names_loading)
+		return;
+
 	fe_userlist_insert(sess, user_ref, row, false);
 	fe_userlist_numbers (*sess);
 }
@@ -473,6 +787,167 @@ userlist_rehash (session *sess)
 		fe_userlist_rehash(sess, user);
 }
 
+/* a NAMES reply is coming in: collect its users unsorted and keep the
+   GUI out of it until userlist_end_load */
+void
+userlist_begin_load (session &sess)
+{
+	sess.names_loading = true;
+}
+
+void
+userlist_end_load (session &sess)
+{
+	if (!sess.names_loading)
+		return;
+	sess.names_loading = false;
+
+	auto & locale = sess.server->current_locale();
+	std::stable_sort(sess.usertree.begin(), sess.usertree.end(), usertree_less{ locale });
+	sess.usertree_sort = prefs.hex_gui_ulist_sort;
+	std::stable_sort(sess.usertree_alpha.begin(), sess.usertree_alpha.end(), alpha_less{ locale });
+	std::sort(sess.usertree_key.begin(), sess.usertree_key.end(), key_less());
+
+	fe_userlist_load (sess);
+	fe_userlist_numbers (sess);
+}
+
+/* the casemapping changed; fold every nick again */
+void
+userlist_rekey (server &serv)
+{
+	/* the session indexes point into the keys about to change */
+	for (auto list = sess_list; list; list = g_slist_next(list))
+	{
+		auto sess = static_cast<session *>(list->data);
+		if (sess->server == &serv)
+			sess->usernames.clear();
+	}
+
+	std::vector<std::unique_ptr<network_user>> entries;
+	for (auto & entry : serv.users)
+		entries.push_back(std::move(entry.second));
+	serv.users.clear();
+
+	for (auto & entry : entries)
+	{
+		entry->key = casemapped(serv, entry->nick);
+		auto found = serv.users.find(entry->key);
+		if (found == serv.users.end())
+		{
+			serv.users.emplace(entry->key, std::move(entry));
+			continue;
+		}
+		/* two nicks are the same person under the new mapping */
+		auto & into = *found->second;
+		for (auto & member : entry->channels)
+		{
+			member.second->info = &into;
+			into.channels.push_back(member);
+		}
+	}
+
+	for (auto list = sess_list; list; list = g_slist_next(list))
+	{
+		auto sess = static_cast<session *>(list->data);
+		if (sess->server != &serv)
+			continue;
+		for (auto & user : sess->usertree)
+			sess->usernames.emplace(user->info->key, user.get());
+		std::sort(sess->usertree_key.begin(), sess->usertree_key.end(), key_less());
+	}
+}
+
+namespace
+{
+	/* heap bytes behind a string, none while it fits the small-string buffer */
+	std::size_t string_heap(const std::string & s)
+	{
+		static const std::size_t inline_capacity = std::string().capacity();
+		return s.capacity() > inline_capacity ? s.capacity() + 1 : 0;
+	}
+
+	std::size_t string_heap(const boost::optional<std::string> & s)
+	{
+		return s ? string_heap(*s) : 0;
+	}
+
+	/* the User as it was before the directory: nick, folded key and four
+	   optional strings per channel, each allocated separately */
+	struct copied_user
+	{
+		std::string nick;
+		std::string key;
+		boost::optional<std::string> hostname, realname, servername, account;
+		time_t lasttalk;
+		unsigned int access;
+		char prefix[2];
+		bool op, hop, voice, me, away, selected;
+	};
+} // end anonymous namespace
+
+userlist_memory
+userlist_memory_usage ()
+{
+	/* hash nodes: next pointer, cached hash and the value */
+	typedef std::pair<boost::string_ref, void *> index_value;
+	const std::size_t index_node = 2 * sizeof(void *) + sizeof(index_value);
+
+	userlist_memory usage = userlist_memory();
+	usage.bytes = the_user_pool().reserved();
+	for (auto list = serv_list; list; list = g_slist_next(list))
+	{
+		auto serv = static_cast<server *>(list->data);
+		for (auto & name : serv->servernames)
+			usage.bytes += sizeof(name) + string_heap(name) + index_node;
+		for (auto & entry : serv->users)
+		{
+			auto & info = *entry.second;
+			++usage.nicks;
+			usage.bytes += index_node + sizeof(info) + string_heap(info.nick) + string_heap(info.key)
+				+ string_heap(info.hostname) + string_heap(info.realname) + string_heap(info.account)
+				+ info.channels.capacity() * sizeof(info.channels[0]);
+
+			/* what each of its channels would have held on its own */
+			auto copied = sizeof(copied_user) + string_heap(info.nick) + string_heap(info.key)
+				+ string_heap(info.hostname) + string_heap(info.realname) + string_heap(info.account)
+				+ (info.servername ? string_heap(*info.servername) : 0);
+			usage.copied_bytes += copied * info.channels.size();
+		}
+	}
+
+	for (auto list = sess_list; list; list = g_slist_next(list))
+	{
+		auto sess = static_cast<session *>(list->data);
+		usage.memberships += sess->usertree.size();
+		/* the sorted trees and the nick index */
+		auto indexes = sess->usertree.capacity() * sizeof(sess->usertree[0])
+			+ sess->usertree_alpha.capacity() * sizeof(sess->usertree_alpha[0])
+			+ sess->usertree_key.capacity() * sizeof(sess->usertree_key[0])
+			+ sess->usernames.size() * index_node
+			+ sess->usernames.bucket_count() * sizeof(void *);
+		usage.bytes += indexes;
+		usage.copied_bytes += indexes;
+		for (auto & user : sess->usertree)
+			usage.bytes += string_heap(user->nick);
+	}
+	return usage;
+}
+
+/* everyone whose nick starts with |prefix|, by folded nick; callers that
+   want last-talk order (hex_completion_sort) sort the matches themselves */
+std::vector<struct User *>
+userlist_complete (session &sess, const boost::string_ref & prefix)
+{
+	userlist_end_load (sess);
+	casemapped_name key(sess.server->casemap, prefix);
+	std::vector<User *> matches;
+	auto pos = std::lower_bound(sess.usertree_key.begin(), sess.usertree_key.end(), key.get(), key_less());
+	for (; pos != sess.usertree_key.end() && key_less::key(*pos).starts_with(key.get()); ++pos)
+		matches.push_back(*pos);
+	return matches;
+}
+
 GSList *
 userlist_flat_list (session *sess)
 {
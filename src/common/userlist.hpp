@@ -25,28 +25,54 @@
 #include <locale>
 #include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 #include <boost/optional.hpp>
 #include "proto-irc.hpp"
 #include "sessfwd.hpp"
 #include "serverfwd.hpp"
 
-struct User
+/* what the network knows about a nick; one per server, shared by the
+   User of every channel the nick is on */
+struct network_user
 {
-	User();
+	network_user();
 	std::string nick;
-	boost::optional<std::string> hostname;
+	std::string key;	/* nick folded by the server's casemapping */
+	boost::optional<std::string> hostname;	/* user@host */
 	boost::optional<std::string> realname;
-	boost::optional<std::string> servername;
+	const std::string *servername;	/* interned in server::servernames */
 	boost::optional<std::string> account;
+	bool away;
+	/* channels it is on; the entry goes away with the last one */
+	std::vector<std::pair<session *, struct User *>> channels;
+};
+
+/* one prefix change (+o, -v, ...) out of a MODE line */
+struct userlist_mode_change
+{
+	std::string nick;
+	char mode;
+	char sign;
+};
+
+/* a nick's membership of one channel; there can be hundreds of thousands
+   of these, so they are kept small and carved out of a pool */
+struct User
+{
+	User();
+	static void *operator new (std::size_t size);
+	static void operator delete (void *p, std::size_t size);
+	std::string nick;
+	network_user *info;	/* also holds the folded nick */
 	time_t lasttalk;
 	unsigned int access;	/* axs bit field */
 	char prefix[2]; /* @ + % */
-	bool op;
-	bool hop;
-	bool voice;
-	bool me;
-	bool away;
-	bool selected;
+	bool op : 1;
+	bool hop : 1;
+	bool voice : 1;
+	bool me : 1;
+	bool selected : 1;
 };
 
 class userlist
@@ -69,11 +95,23 @@ public:
 };
 enum{ USERACCESS_SIZE = 12 };
 
-bool userlist_add_hostname (session *sess, const char nick[],
+/* for /debug */
+struct userlist_memory
+{
+	std::size_t memberships;
+	std::size_t nicks;			/* directory entries */
+	std::size_t bytes;			/* everything the userlists hold */
+	std::size_t copied_bytes;	/* the same with every string copied per channel */
+};
+userlist_memory userlist_memory_usage ();
+
+bool userlist_add_hostname (server &serv, const char nick[],
 									const char hostname[], const char realname[],
 									const char servername[], const char account[], unsigned int away);
-void userlist_set_away (session *sess, const char nick[], bool away);
-void userlist_set_account (session *sess, const char nick[], const char account[]);
+void userlist_set_away (server &serv, const char nick[], bool away);
+void userlist_set_account (server &serv, const char nick[], const char account[]);
+void userlist_set_hostname (server &serv, const char nick[], const char hostname[]);
+network_user *userlist_lookup (server &serv, const boost::string_ref & name);
 struct User *userlist_find(session *sess, const boost::string_ref & name);
 struct User *userlist_find_global (server *serv, const std::string & name);
 void userlist_clear (session *sess);
@@ -82,10 +120,14 @@ void userlist_add (session *sess, const char name[], const char hostname[], cons
 						const char realname[], const message_tags_data *tags_data);
 bool userlist_remove (session *sess, const char name[]);
 void userlist_remove_user (session *sess, struct User *user);
-bool userlist_change (session *sess, const std::string & oldname, const std::string & newname);
-void userlist_update_mode (session *sess, const char name[], char mode, char sign);
+network_user *userlist_change (server &serv, const std::string & oldname, const std::string & newname);
+void userlist_update_modes (session &sess, const std::vector<userlist_mode_change> &changes);
+std::vector<struct User *> userlist_complete (session &sess, const boost::string_ref & prefix);
 GSList *userlist_flat_list (session *sess);
 GList *userlist_double_list (session *sess);
 void userlist_rehash (session *sess);
+void userlist_rekey (server &serv);
+void userlist_begin_load (session &sess);
+void userlist_end_load (session &sess);
 
 #endif
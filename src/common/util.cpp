@@ -49,6 +49,14 @@
 #include <boost/regex.hpp>
 #include <boost/format.hpp>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define UTIL_USE_SSE2
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 #ifdef WIN32
 #define WIN32_LEAN_AND_MEAN
 #define NOMINMAX
@@ -304,70 +312,171 @@ std::string strip_color(const std::string &text, strip_flags flags)
 }
 
 
-std::string 
-strip_color2(const std::string & src, strip_flags flags)
+namespace
 {
+	/* what strip_color_buf makes of each byte */
+	enum strip_class : unsigned char
+	{
+		strip_text,
+		strip_digit,
+		strip_comma,
+		strip_color_code,	/* ATTR_COLOR */
+		strip_hidden_code,	/* HIDDEN_CHAR */
+		strip_attrib_code	/* beep, reset, reverse, bold, underline, italics */
+	};
+
+	struct strip_table
+	{
+		unsigned char cls[256];
+		strip_table()
+		{
+			std::fill(std::begin(cls), std::end(cls), strip_text);
+			for (int c = '0'; c <= '9'; ++c)
+				cls[c] = strip_digit;
+			cls[','] = strip_comma;
+			cls['\003'] = strip_color_code;
+			cls[static_cast<unsigned char>(HIDDEN_CHAR)] = strip_hidden_code;
+			for (unsigned char c : { '\007', '\017', '\026', '\002', '\037', '\035' })
+				cls[c] = strip_attrib_code;
+		}
+	};
+
+	const strip_table & strip_classes()
+	{
+		static const strip_table table;
+		return table;
+	}
+
+#ifdef UTIL_USE_SSE2
+	std::size_t lowest_bit(unsigned int mask)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward(&index, mask);
+		return index;
+#else
+		return __builtin_ctz(mask);
+#endif
+	}
+#endif
+
+	/* offset of the first byte below 0x20, or |len|. Every code the
+	   stripper removes is one, and most lines have none at all */
+	std::size_t first_control(const unsigned char * p, std::size_t len)
+	{
+		std::size_t i = 0;
+#ifdef UTIL_USE_SSE2
+		const __m128i limit = _mm_set1_epi8(0x1f);
+		for (; i + 16 <= len; i += 16)
+		{
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+			auto mask = static_cast<unsigned int>(_mm_movemask_epi8(
+				_mm_cmpeq_epi8(_mm_max_epu8(v, limit), limit)));
+			if (mask)
+				return i + lowest_bit(mask);
+		}
+#else
+		/* portable fallback: a 64-bit word at a time */
+		for (; i + 8 <= len; i += 8)
+		{
+			std::uint64_t w;
+			std::memcpy(&w, p + i, sizeof(w));
+			if ((w - 0x2020202020202020ULL) & ~w & 0x8080808080808080ULL)
+				break;
+		}
+#endif
+		while (i < len && p[i] >= 0x20)
+			++i;
+		return i;
+	}
+}
+
+/* Copies |len| bytes of |src| to |dst| without the control codes selected
+   by |flags| and returns the length written, never more than |len|.
+   |dst| may be |src| to strip in place. */
+std::size_t
+strip_color_buf(const char *src, std::size_t len, strip_flags flags, char *dst)
+{
+	auto p = reinterpret_cast<const unsigned char*>(src);
+	std::size_t i = first_control(p, len);
+	if (dst != src)
+		std::memmove(dst, src, i);
+	if (i == len)
+		return len;
+
+	const unsigned char *cls = strip_classes().cls;
+	std::size_t out = i;
 	int rcol = 0, bgcol = 0;
-	auto src_itr = src.cbegin();
-	int len = src.size();
-	std::ostringstream dst_stream;
-	std::ostream_iterator<char> dst_itr(dst_stream);
-	std::locale locale;
-	while (len-- > 0)
+	for (; i < len; ++i)
 	{
-		if (rcol > 0 && (std::isdigit (*src_itr, locale) ||
-			(*src_itr == ',' && std::isdigit(src_itr[1], locale) && !bgcol)))
+		const unsigned char c = p[i];
+		const unsigned char next = i + 1 < len ? cls[p[i + 1]] : strip_text;
+		/* the digits (and one comma) after a \003 belong to it */
+		if (rcol > 0 && (cls[c] == strip_digit ||
+			(cls[c] == strip_comma && next == strip_digit && !bgcol)))
 		{
-			if (src_itr[1] != ',') rcol--;
-			if (*src_itr == ',')
+			if (next != strip_comma) rcol--;
+			if (cls[c] == strip_comma)
 			{
 				rcol = 2;
 				bgcol = 1;
 			}
-		} else
+			continue;
+		}
+
+		rcol = bgcol = 0;
+		switch (cls[c])
 		{
-			rcol = bgcol = 0;
-			switch (*src_itr)
-			{
-			case '\003':			  /*ATTR_COLOR: */
-				if (!(flags & STRIP_COLOR)) goto pass_char;
-				rcol = 2;
+		case strip_color_code:
+			if (!(flags & STRIP_COLOR))
 				break;
-			case HIDDEN_CHAR:	/* CL: invisible text (for event formats only) */	/* this takes care of the topic */
-				if (!(flags & STRIP_HIDDEN)) goto pass_char;
+			rcol = 2;
+			continue;
+		case strip_hidden_code:
+			if (!(flags & STRIP_HIDDEN))
 				break;
-			case '\007':			  /*ATTR_BEEP: */
-			case '\017':			  /*ATTR_RESET: */
-			case '\026':			  /*ATTR_REVERSE: */
-			case '\002':			  /*ATTR_BOLD: */
-			case '\037':			  /*ATTR_UNDERLINE: */
-			case '\035':			  /*ATTR_ITALICS: */
-				if (!(flags & STRIP_ATTRIB)) goto pass_char;
+			continue;
+		case strip_attrib_code:
+			if (!(flags & STRIP_ATTRIB))
 				break;
-			default:
-			pass_char:
-				*dst_itr++ = *src_itr;
-			}
+			continue;
 		}
-		src_itr++;
+		dst[out++] = static_cast<char>(c);
 	}
+	return out;
+}
 
-	return dst_stream.str();
+std::string 
+strip_color2(const std::string & src, strip_flags flags)
+{
+	std::string dst;
+	strip_color2(src, flags, dst);
+	return dst;
 }
 
-int
-strip_hidden_attribute(const std::string & src, char *dst)
+/* appends |src| to |dst| without the control codes selected by |flags| */
+void
+strip_color2(const boost::string_ref & src, strip_flags flags, std::string & dst)
 {
-	int len = 0;
-	for (char sval : src)
+	auto start = dst.size();
+	dst.resize(start + src.size());
+	dst.resize(start + strip_color_buf(src.data(), src.size(), flags, &dst[start]));
+}
+
+/* appends |src| to |dst| without HIDDEN_CHAR */
+void
+strip_hidden_attribute(const boost::string_ref & src, std::string & dst)
+{
+	auto start = src.cbegin();
+	for (auto itr = start; itr != src.cend(); ++itr)
 	{
-		if (sval != HIDDEN_CHAR)
+		if (*itr == HIDDEN_CHAR)
 		{
-			*dst++ = sval;
-			len++;
+			dst.append(start, itr);
+			start = itr + 1;
 		}
 	}
-	return len;
+	dst.append(start, src.cend());
 }
 
 #if defined (USING_LINUX) || defined (USING_FREEBSD) || defined (__APPLE__) || defined (__CYGWIN__)
@@ -1249,6 +1358,70 @@ const unsigned char rfc_tolowertab[] =
 	0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff
 };
 
+namespace
+{
+	/* rfc1459 is rfc_tolowertab itself; the other two fold less of it */
+	struct casemap_tables
+	{
+		unsigned char strict[256];
+		unsigned char ascii[256];
+
+		casemap_tables()
+		{
+			for (int c = 0; c < 256; ++c)
+				strict[c] = ascii[c] = rfc_tolowertab[c];
+			/* strict-rfc1459 does not pair ^ with ~ */
+			strict['^'] = '^';
+			/* ascii only folds A-Z */
+			ascii['['] = '[';
+			ascii['\\'] = '\\';
+			ascii[']'] = ']';
+			ascii['^'] = '^';
+		}
+	};
+} // end anonymous namespace
+
+const unsigned char *
+casemap_table (casemapping mapping)
+{
+	static const casemap_tables tables;
+	switch (mapping)
+	{
+	case casemapping::strict_rfc1459:
+		return tables.strict;
+	case casemapping::ascii:
+		return tables.ascii;
+	default:
+		return rfc_tolowertab;
+	}
+}
+
+casemapped_name::casemapped_name(const unsigned char *table, const boost::string_ref & name)
+{
+	char *out = buf_;
+	if (name.size() > sizeof(buf_))
+	{
+		long_.resize(name.size());
+		out = &long_[0];
+	}
+	for (std::size_t i = 0; i < name.size(); ++i)
+		out[i] = table[static_cast<unsigned char>(name[i])];
+	name_ = boost::string_ref(out, name.size());
+}
+
+std::size_t
+string_ref_hash::operator()(const boost::string_ref & key) const
+{
+	/* FNV-1a */
+	std::size_t h = 2166136261u;
+	for (auto c : key)
+	{
+		h ^= static_cast<unsigned char>(c);
+		h *= 16777619u;
+	}
+	return h;
+}
+
 /*static unsigned char touppertab[] =
 	{ 0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0x8, 0x9, 0xa,
 	0xb, 0xc, 0xd, 0xe, 0xf, 0x10, 0x11, 0x12, 0x13, 0x14,
@@ -38,6 +38,8 @@
 #include <functional>
 #include <string>
 #include <vector>
+#include <boost/utility/string_ref.hpp>
+#include "sessfwd.hpp"
 
 #define rfc_tolower(c) (rfc_tolowertab[(unsigned char)(c)])
 
@@ -45,6 +47,32 @@ extern const unsigned char rfc_tolowertab[];
 
 std::locale rfc_locale(const std::locale& locale);
 
+/* the ISUPPORT CASEMAPPING flavours, each backed by a lowercasing table */
+enum class casemapping { rfc1459, strict_rfc1459, ascii };
+const unsigned char *casemap_table (casemapping mapping);
+
+/* a nick or channel folded through a casemap table; names up to CHANLEN
+   stay on the stack so lookups don't allocate. get() may point into this
+   object, so it can't be copied or moved */
+class casemapped_name
+{
+	char buf_[CHANLEN];
+	std::string long_;
+	boost::string_ref name_;
+public:
+	casemapped_name(const unsigned char *table, const boost::string_ref & name);
+	casemapped_name(const casemapped_name&) = delete;
+	casemapped_name& operator=(const casemapped_name&) = delete;
+	const boost::string_ref & get() const { return name_; }
+	std::string str() const { return name_.to_string(); }
+};
+
+/* hashes the bytes as they are, so keys must be casemapped already */
+struct string_ref_hash
+{
+	std::size_t operator()(const boost::string_ref & key) const;
+};
+
 char *expand_homedir (char *file);
 void path_part (char *file, char *path, int pathlen);
 bool match (const char *mask, const char *string);
@@ -69,7 +97,9 @@ enum strip_flags{
 
 std::string strip_color(const std::string &text, strip_flags flags);
 std::string strip_color2(const std::string & src, strip_flags flags);
-int strip_hidden_attribute (const std::string & src, char *dst);
+std::size_t strip_color_buf(const char *src, std::size_t len, strip_flags flags, char *dst);
+void strip_color2(const boost::string_ref & src, strip_flags flags, std::string & dst);
+void strip_hidden_attribute (const boost::string_ref & src, std::string & dst);
 char *errorstring (int err);
 int waitline (int sok, char *buf, int bufsize, int);
 #ifdef WIN32
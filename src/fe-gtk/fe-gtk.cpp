@@ -792,7 +792,11 @@ fe_set_throttle (server *serv)
 	char tbuf[96];
 	char tip[160];
 
-	per = (float) serv->sendq_len / 1024.0;
+	const int sendq_len = serv->outbound_queue.queue_length();
+	const int sendq_lines = serv->outbound_queue.size();
+	const int drain_secs = std::chrono::duration_cast<std::chrono::seconds>(serv->outbound_queue.time_to_drain()).count();
+
+	per = (float) sendq_len / 1024.0;
 	if (per > 1.0)
 		per = 1.0;
 
@@ -801,8 +805,9 @@ fe_set_throttle (server *serv)
 		sess = static_cast<session*>(list->data);
 		if (sess->server == serv)
 		{
-			snprintf (tbuf, sizeof (tbuf) - 1, _("%d bytes"), serv->sendq_len);
-			snprintf (tip, sizeof (tip) - 1, _("Network send queue: %d bytes"), serv->sendq_len);
+			snprintf (tbuf, sizeof (tbuf) - 1, _("%d bytes"), sendq_len);
+			snprintf (tip, sizeof (tip) - 1, _("Network send queue: %d bytes in %d lines, sent within %d seconds"),
+						 sendq_len, sendq_lines, drain_secs);
 
 			sess->res->queue_tip = tip;
 
@@ -1464,7 +1464,10 @@ struct session *sess)
 		gcomp.reset(g_completion_new(nullptr));
 		if (is_nick)
 		{
-			std::vector < User* > tmp_vec { sess->usertree_alpha };
+			/* only the nicks that can match, straight from the index;
+			   a running completion keeps matching its original text */
+			bool cycling = comp && rfc_ncasecmp (old_gcomp.data, ent, old_gcomp.elen) == 0;
+			auto tmp_vec = userlist_complete (*sess, cycling ? old_gcomp.data : ent);
 			if (prefs.hex_completion_sort == 1)	/* sort in last-talk order? */
 				std::sort(tmp_vec.begin(), tmp_vec.end(), talked_recent_cmp);
 			for (auto usr : tmp_vec)
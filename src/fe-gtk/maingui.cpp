@@ -3490,8 +3490,8 @@ mg_changui_new (session *sess, restore_gui *res, int tab, int focus)
 		sess->gui = gui;
 		mg_create_topwindow (sess);
 		fe_set_title (*sess);
-		if (user && user->hostname)
-			set_topic (sess, *user->hostname, *user->hostname);
+		if (user && user->info->hostname)
+			set_topic (sess, *user->info->hostname, *user->info->hostname);
 		return;
 	}
 
@@ -3511,8 +3511,8 @@ mg_changui_new (session *sess, restore_gui *res, int tab, int focus)
 		gui->is_tab = TRUE;
 	}
 
-	if (user && user->hostname)
-		set_topic (sess, *user->hostname, *user->hostname);
+	if (user && user->info->hostname)
+		set_topic (sess, *user->info->hostname, *user->info->hostname);
 
 	mg_add_chan (sess);
 
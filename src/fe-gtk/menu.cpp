@@ -142,15 +142,15 @@ nick_command_parse(session *sess, const boost::string_ref & cmd, const boost::st
 		user = userlist_find (sess, nick);
 		if (user)
 		{
-			if (user->hostname)
+			if (user->info->hostname)
 			{
-				auto at_idx = user->hostname->find_first_of('@');
+				auto at_idx = user->info->hostname->find_first_of('@');
 				if (at_idx == std::string::npos)
 					throw std::runtime_error("invalid user hostname");
-				host = user->hostname->substr(at_idx + 1);
+				host = user->info->hostname->substr(at_idx + 1);
 			}
-			if (user->account)
-				account = user->account ? user->account->c_str() : nullptr;
+			if (user->info->account)
+				account = user->info->account ? user->info->account->c_str() : nullptr;
 		}
 	}
 
@@ -610,9 +610,9 @@ menu_create_nickinfo_menu (struct User *user, GtkWidget *submenu)
 	fmt = _("<tt><b>%-11s</b></tt> %s");
 	snprintf (unknown, sizeof (unknown), "<i>%s</i>", _("Unknown"));
 
-	if (user->realname)
+	if (user->info->realname)
 	{
-		auto real = strip_color (user->realname.get(), static_cast<strip_flags>(STRIP_ALL|STRIP_ESCMARKUP));
+		auto real = strip_color (user->info->realname.get(), static_cast<strip_flags>(STRIP_ALL|STRIP_ESCMARKUP));
 		snprintf (buf, sizeof (buf), fmt, _("Real Name:"), real.c_str());
 	} else
 	{
@@ -621,23 +621,23 @@ menu_create_nickinfo_menu (struct User *user, GtkWidget *submenu)
 	item = menu_quick_item (0, buf, submenu, XCMENU_MARKUP, 0, 0);
 	g_signal_connect (G_OBJECT (item), "activate",
 							G_CALLBACK (copy_to_clipboard_cb), 
-							user->realname ? &(*user->realname)[0] : unknown);
+							user->info->realname ? &(*user->info->realname)[0] : unknown);
 
 	snprintf (buf, sizeof (buf), fmt, _("User:"),
-				 user->hostname ? user->hostname->c_str() : unknown);
+				 user->info->hostname ? user->info->hostname->c_str() : unknown);
 	item = menu_quick_item (0, buf, submenu, XCMENU_MARKUP, 0, 0);
 	g_signal_connect (G_OBJECT (item), "activate",
 							G_CALLBACK (copy_to_clipboard_cb), 
-							(gpointer)(user->hostname ? user->hostname->c_str() : unknown));
+							(gpointer)(user->info->hostname ? user->info->hostname->c_str() : unknown));
 	
 	snprintf (buf, sizeof (buf), fmt, _("Account:"),
-				 user->account ? user->account->c_str() : unknown);
+				 user->info->account ? user->info->account->c_str() : unknown);
 	item = menu_quick_item (0, buf, submenu, XCMENU_MARKUP, 0, 0);
 	g_signal_connect (G_OBJECT (item), "activate",
 							G_CALLBACK (copy_to_clipboard_cb), 
-							user->account ? &(*user->account)[0] : unknown);
+							user->info->account ? &(*user->info->account)[0] : unknown);
 
-	users_country = user->hostname ? country(user->hostname.get()) : nullptr;
+	users_country = user->info->hostname ? country(user->info->hostname.get()) : nullptr;
 	if (users_country)
 	{
 		snprintf (buf, sizeof (buf), fmt, _ ("Country:"), users_country);
@@ -647,11 +647,11 @@ menu_create_nickinfo_menu (struct User *user, GtkWidget *submenu)
 	}
 
 	snprintf (buf, sizeof (buf), fmt, _("Server:"),
-				 user->servername ? user->servername->c_str() : unknown);
+				 user->info->servername ? user->info->servername->c_str() : unknown);
 	item = menu_quick_item (0, buf, submenu, XCMENU_MARKUP, 0, 0);
 	g_signal_connect (G_OBJECT (item), "activate",
 							G_CALLBACK (copy_to_clipboard_cb), 
-							user->servername ? &(*user->servername)[0] : unknown);
+							(gpointer)(user->info->servername ? user->info->servername->c_str() : unknown));
 
 	if (user->lasttalk)
 	{
@@ -666,7 +666,7 @@ menu_create_nickinfo_menu (struct User *user, GtkWidget *submenu)
 	}
 	menu_quick_item (0, buf, submenu, XCMENU_MARKUP, 0, 0);
 
-	if (user->away)
+	if (user->info->away)
 	{
 		auto away = current_sess->server->get_away_message(user->nick);// server_away_find_message(current_sess->server, user->nick);
 		if (away)
@@ -740,7 +740,7 @@ menu_nickmenu (session *sess, GdkEventButton *event, const std::string &nick, in
 			nick_submenu = submenu = menu_quick_sub (nick.c_str(), menu, NULL, XCMENU_DOLIST, -1);
 
 			if (menu_create_nickinfo_menu (user, submenu) ||
-				 !user->hostname || !user->realname || !user->servername)
+				 !user->info->hostname || !user->info->realname || !user->info->servername)
 			{
 				g_signal_connect (G_OBJECT (submenu), "show", G_CALLBACK (menu_nickinfo_cb), sess);
 			}
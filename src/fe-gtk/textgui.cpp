@@ -48,7 +48,7 @@
 typedef std::char_traits < unsigned char > uchar_traits;
 extern const text_event te[];
 extern std::array<std::string, NUM_XP> pntevts_text;
-extern std::array<std::string, NUM_XP> pntevts;
+extern std::array<pevt_template, NUM_XP> pntevts;
 
 static GtkWidget *pevent_dialog = NULL, *pevent_dialog_twid,
 	*pevent_dialog_list, *pevent_dialog_hlist;
@@ -166,7 +166,7 @@ pevent_edited (GtkCellRendererText *render, gchar *pathstr, gchar *new_text, gpo
 
 	text = new_text;
 	auto len = strlen (new_text);
-	std::string out;
+	pevt_template out;
 	if (pevt_build_string (text, out, m) != 0)
 	{
 		fe_message (_("There was an error parsing the string"), FE_MSG_ERROR);
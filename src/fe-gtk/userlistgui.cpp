@@ -25,6 +25,7 @@
 #include <cstring>
 #include <cstdlib>
 #include <utility>
+#include <vector>
 #include <boost/utility/string_ref.hpp>
 
 #include "fe-gtk.hpp"
@@ -315,26 +316,24 @@ fe_userlist_rehash (session *sess, struct User const *user)
 		return;
 
 	int nick_color = 0;
-	if (prefs.hex_away_track && user->away)
+	if (prefs.hex_away_track && user->info->away)
 		nick_color = COL_AWAY;
 	else if (prefs.hex_gui_ulist_color)
 		nick_color = text_color_of(user->nick);
 
 	gtk_list_store_set (GTK_LIST_STORE (sess->res->user_model), result.first.get(),
-							  COL_HOST, user->hostname ? user->hostname->c_str() : nullptr,
+							  COL_HOST, user->info->hostname ? user->info->hostname->c_str() : nullptr,
 							  COL_GDKCOLOR, nick_color ? &colors[nick_color] : NULL,
 							  -1);
 }
 
-void
-fe_userlist_insert (session *sess, struct User *newuser, int row, bool sel)
+static GdkPixbuf *
+userlist_store_user (session *sess, GtkListStore *store, GtkTreeIter *iter, struct User *newuser, int row)
 {
-	GtkTreeModel *model = static_cast<GtkTreeModel*>(sess->res->user_model);
 	GdkPixbuf *pix = get_user_icon (sess->server, newuser);
-	GtkTreeIter iter;
 	int nick_color = 0;
 
-	if (prefs.hex_away_track && newuser->away)
+	if (prefs.hex_away_track && newuser->info->away)
 		nick_color = COL_AWAY;
 	else if (prefs.hex_gui_ulist_color)
 		nick_color = text_color_of(newuser->nick);
@@ -347,10 +346,10 @@ fe_userlist_insert (session *sess, struct User *newuser, int row, bool sel)
 		pix = NULL;
 	}
 
-	gtk_list_store_insert_with_values (GTK_LIST_STORE (model), &iter, row,
+	gtk_list_store_insert_with_values (store, iter, row,
 									COL_PIX, pix,
 									COL_NICK, nick.c_str(),
-									COL_HOST, newuser->hostname ? newuser->hostname->c_str() : nullptr,
+									COL_HOST, newuser->info->hostname ? newuser->info->hostname->c_str() : nullptr,
 									COL_USER, newuser,
 									COL_GDKCOLOR, nick_color ? &colors[nick_color] : NULL,
 								  -1);
@@ -361,6 +360,16 @@ fe_userlist_insert (session *sess, struct User *newuser, int row, bool sel)
 		if (!sess->gui->is_tab || sess == current_tab)
 			mg_set_access_icon (sess->gui, pix, sess->server->is_away);
 	}
+	return pix;
+}
+
+void
+fe_userlist_insert (session *sess, struct User *newuser, int row, bool sel)
+{
+	GtkTreeModel *model = static_cast<GtkTreeModel*>(sess->res->user_model);
+	GtkTreeIter iter;
+
+	userlist_store_user (sess, GTK_LIST_STORE (model), &iter, newuser, row);
 
 	/* is it the front-most tab? */
 	if (gtk_tree_view_get_model (GTK_TREE_VIEW (sess->gui->user_tree))
@@ -372,6 +381,45 @@ fe_userlist_insert (session *sess, struct User *newuser, int row, bool sel)
 	}
 }
 
+/* fill a fresh model from the (sorted) usertree and swap it in, so the
+   GtkTreeView sees a single change instead of one per row; the front-most
+   tab keeps its selection and scroll position */
+void
+fe_userlist_load (session &sess)
+{
+	auto old_model = static_cast<GtkTreeModel*>(sess.res->user_model);
+	auto store = static_cast<GtkListStore*>(userlist_create_model ());
+	GtkTreeIter iter;
+
+	/* is it the front-most tab? */
+	bool front = gtk_tree_view_get_model (GTK_TREE_VIEW (sess.gui->user_tree)) == old_model;
+	gfloat scroll = 0;
+	if (front)
+	{
+		fe_userlist_set_selected (&sess);
+		scroll = userlist_get_value (sess.gui->user_tree);
+	}
+
+	std::vector<GtkTreeIter> selected;
+	for (auto & user : sess.usertree)
+	{
+		userlist_store_user (&sess, store, &iter, user.get(), -1);
+		if (front && user->selected)
+			selected.push_back (iter);
+	}
+
+	sess.res->user_model = store;
+	if (front)
+	{
+		userlist_show (&sess);
+		auto selection = gtk_tree_view_get_selection (GTK_TREE_VIEW (sess.gui->user_tree));
+		for (auto & row : selected)
+			gtk_tree_selection_select_iter (selection, &row);
+		userlist_set_value (sess.gui->user_tree, scroll);
+	}
+	g_object_unref (G_OBJECT (old_model));
+}
+
 void
 fe_userlist_move (session *sess, struct User *user, int new_row)
 {
@@ -56,6 +56,7 @@ struct server_gui{ int foo; };
 struct session_gui{ int bar; };
 
 static bool done = false;		  /* finished ? */
+GMainLoop *main_loop;
 
 
 static void
@@ -566,6 +567,10 @@ fe_init (void)
 void
 fe_main (void)
 {
+#ifdef HEXCHAT_TEXT_BENCH
+	text_bench ();
+	return;
+#endif
 	GIOChannel *keyboard_input;
 
 	main_loop = g_main_loop_new(NULL, FALSE);
@@ -723,6 +728,10 @@ fe_userlist_clear (session &)
 {
 }
 void
+fe_userlist_load (session &)
+{
+}
+void
 fe_userlist_set_selected (struct session *)
 {
 }
@@ -17,4 +17,9 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
  */
 
-GMainLoop *main_loop;
+extern GMainLoop *main_loop;
+
+#ifdef HEXCHAT_TEXT_BENCH
+/* text-bench.cpp; runs instead of the main loop */
+void text_bench (void);
+#endif
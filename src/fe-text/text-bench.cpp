@@ -0,0 +1,100 @@
+/* HexChat
+ * Copyright (C) 2014 Berke Viktor.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/* Times format_event on Channel Message events, the way display_event
+ * renders them, with and without color stripping of the arguments.
+ *
+ * hexchat-text-bench is hexchat-text with fe_main replaced by this, so the
+ * text events are the ones hexchat loaded; give it a scratch config with
+ * -d to leave yours alone. It isn't built by default, run
+ * "make hexchat-text-bench" here. Besides the time it counts the heap
+ * allocations made while rendering (it replaces the global operator new
+ * for that), which should be none once the output buffer has grown.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+#include "../common/hexchat.hpp"
+#include "../common/hexchatc.hpp"
+#include "../common/text.hpp"
+#include "fe-text.h"
+
+namespace
+{
+	const std::size_t events = 1000000;
+	std::size_t allocations;
+
+	void run(const char * name, const char * const args[], unsigned int stripcolor_args)
+	{
+		std::string buf;
+		std::size_t bytes = 0;
+		/* let the buffer grow to size first, as display_event's does */
+		format_event (current_sess, XP_TE_CHANMSG, args, buf, stripcolor_args);
+
+		auto before = allocations;
+		auto start = std::chrono::steady_clock::now ();
+		for (std::size_t i = 0; i < events; ++i)
+		{
+			format_event (current_sess, XP_TE_CHANMSG, args, buf, stripcolor_args);
+			bytes += buf.size ();
+		}
+		auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now () - start).count ();
+
+		std::printf ("%-12s %lu events %8.1f ns/event %8.1f MB/s %lu allocations\n", name,
+			static_cast<unsigned long>(events),
+			static_cast<double>(elapsed) / events,
+			elapsed ? bytes * 1000.0 / elapsed : 0.0,
+			static_cast<unsigned long>(allocations - before));
+	}
+}
+
+void *
+operator new (std::size_t size)
+{
+	++allocations;
+	if (void * p = std::malloc (size ? size : 1))
+		return p;
+	throw std::bad_alloc ();
+}
+
+void
+operator delete (void * p) noexcept
+{
+	std::free (p);
+}
+
+void
+text_bench (void)
+{
+	const char * const args[] = {
+		"Channel Message",
+		"\00312someone\017",
+		"\002hello\002 everyone, \0034this\003 is a \037fairly\037 ordinary line of chat with a \00309,01few colors\003 in it",
+		"",
+		"@",
+		"",
+	};
+
+	run ("plain", args, 0);
+	/* what text_emit passes with stripcolor_msg on: the nick keeps its color */
+	run ("stripcolor", args, 0xFFFFFFFF & ~(1u << 1));
+}
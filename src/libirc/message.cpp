@@ -16,68 +16,102 @@
 * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
 */
 
-#include <cstdlib>
-#include <string>
-#include <vector>
-#include <boost/algorithm/string.hpp>
+#include <algorithm>
+#include <boost/utility/string_ref.hpp>
 #include "message.hpp"
 
 namespace
 {
-	namespace rfc2812
+	void skip_spaces(boost::string_ref & rest)
 	{
-		const std::string::size_type max_prefix_len = 64;
-		const std::string::size_type max_message_len = 512;
+		while (!rest.empty() && rest.front() == ' ')
+			rest.remove_prefix(1);
+	}
+
+	// the text up to the next space, which is consumed along with it
+	boost::string_ref next_token(boost::string_ref & rest)
+	{
+		auto end = std::min(rest.find(' '), rest.size());
+		auto token = rest.substr(0, end);
+		rest.remove_prefix(end);
+		skip_spaces(rest);
+		return token;
 	}
 }
 
 namespace irc
 {
-	boost::optional<message> parse(const std::string & inbound)
+	message_view::message_view()
+		:numeric(0), param_count(0), has_trailing(false)
+	{}
+
+	boost::optional<boost::string_ref> message_view::tag(const boost::string_ref & key) const
 	{
-		message m;
-		// if we're getting garbage, just ignore it
-		if (inbound.size() > rfc2812::max_message_len)
+		auto rest = tags;
+		while (!rest.empty())
 		{
-			return boost::none;
+			auto end = std::min(rest.find(';'), rest.size());
+			auto tag = rest.substr(0, end);
+			rest.remove_prefix(std::min(end + 1, rest.size()));
+
+			auto eq = std::min(tag.find('='), tag.size());
+			if (tag.substr(0, eq) == key)
+				return tag.substr(std::min(eq + 1, tag.size()));
 		}
-		// a message must end with a crlf
-		if (!boost::ends_with(inbound, "\r\n"))
-			return boost::none;
-		auto prefix_start_loc = inbound.find_first_of(':');
-		auto prefix_end_loc = inbound.find_first_of(' ');
-		// if there  is a prefix the first character will be :
-		if (prefix_start_loc == 0 &&
-			prefix_end_loc != 0 &&
-			prefix_end_loc != std::string::npos)
+		return boost::none;
+	}
+
+	std::size_t message_view::param_offset(std::size_t i) const
+	{
+		auto offset = static_cast<std::size_t>(params[i].data() - line.data());
+		if (has_trailing && i + 1 == param_count)
+			--offset;
+		return offset;
+	}
+
+	bool parse(const boost::string_ref & line, message_view & msg)
+	{
+		msg = message_view();
+		auto rest = line;
+		while (!rest.empty() && (rest.back() == '\n' || rest.back() == '\r'))
+			rest.remove_suffix(1);
+
+		if (rest.starts_with('@'))
 		{
-			//malformed message
-			if (prefix_end_loc > rfc2812::max_prefix_len)
-				return boost::none;
-			m.prefix = inbound.substr(0, prefix_end_loc);
-			// increment by one so we can get the command
-			++prefix_end_loc;
+			rest.remove_prefix(1);
+			msg.tags = next_token(rest);
 		}
-		else
+
+		msg.line = rest;
+		if (rest.starts_with(':'))
 		{
-			prefix_end_loc = 0;
+			rest.remove_prefix(1);
+			msg.source = next_token(rest);
 		}
 
-		// get the command
-		auto command_end = inbound.find_first_of(' ', prefix_end_loc);
-		// a command is required if we can't parse one bug out
-		if (command_end == std::string::npos || command_end == prefix_end_loc)
-			return boost::none;
-		m.command_s = inbound.substr(prefix_end_loc, command_end - prefix_end_loc);
-		char*end;
-		auto numeric_rep = std::strtol(m.command_s.c_str(), &end, 10);
-		if (numeric_rep)
-			m.command_n = static_cast<message::numeric_reply>(numeric_rep);
+		msg.command = next_token(rest);
+		if (msg.command.empty())
+			return false;
 
-		// there are parameters
-		if (command_end < inbound.size() - 2)
-			m.params = inbound.substr(command_end + 1, inbound.size() - 2);
+		if (msg.command.size() == 3 &&
+			std::all_of(msg.command.begin(), msg.command.end(), [](char c){ return c >= '0' && c <= '9'; }))
+		{
+			msg.numeric = (msg.command[0] - '0') * 100 + (msg.command[1] - '0') * 10 + (msg.command[2] - '0');
+		}
 
-		return m;
+		while (!rest.empty())
+		{
+			// the 15th param takes the rest of the line even without a ':'
+			if (rest.front() == ':' || msg.param_count + 1 == message_view::max_params)
+			{
+				msg.has_trailing = rest.front() == ':';
+				if (msg.has_trailing)
+					rest.remove_prefix(1);
+				msg.params[msg.param_count++] = rest;
+				break;
+			}
+			msg.params[msg.param_count++] = next_token(rest);
+		}
+		return true;
 	}
-}
\ No newline at end of file
+}
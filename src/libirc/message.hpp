@@ -19,31 +19,39 @@
 #ifndef LIBIRC_MESSAGE_HPP
 #define LIBIRC_MESSAGE_HPP
 
-#include <string>
+#include <array>
+#include <cstddef>
 #include <boost/optional.hpp>
+#include <boost/utility/string_ref.hpp>
 
 namespace irc
 {
-	struct message
+	// One IRCv3 line split into its parts. Every field points into the
+	// buffer the line was parsed from, so a message_view must not outlive it.
+	struct message_view
 	{
-		enum numeric_reply
-		{
-			RPL_WELCOME = 1,
-			RPL_YOURHOST,
-			RPL_CREATED,
-			RPL_MYINFO,
-			RPL_BOUNCE,
-
-			RPL_TRACELINK = 200,
-			RPL_TRACECONNECTING
-		};
-		boost::optional<numeric_reply> command_n;
-		std::string command_s;
-		boost::optional<std::string> prefix;
-		boost::optional<std::string> params;
+		static const std::size_t max_params = 15;
+
+		boost::string_ref tags;		// without the leading '@', values still escaped
+		boost::string_ref source;	// without the leading ':', empty if absent
+		boost::string_ref command;
+		int numeric;				// the reply number for three digit commands, otherwise 0
+		std::array<boost::string_ref, max_params> params;
+		std::size_t param_count;
+		bool has_trailing;			// the last param was introduced by ':'
+		boost::string_ref line;		// source, command and params; the line without its tags
+
+		message_view();
+
+		// the raw value of a tag; an empty value for a tag without '='
+		boost::optional<boost::string_ref> tag(const boost::string_ref & key) const;
+		// offset of param |i| in |line|, counting the ':' of a trailing param
+		std::size_t param_offset(std::size_t i) const;
 	};
 
-	boost::optional<message> parse(const std::string & inbound);
+	// Splits |line| without copying or allocating. A trailing CR LF is
+	// ignored. Returns false for a line without a command.
+	bool parse(const boost::string_ref & line, message_view & msg);
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -18,12 +18,17 @@
 #define OPENSSL_NO_SSL2
 #include <atomic>
 #include <algorithm>
-#include <istream>
+#include <cstring>
+#include <map>
 #include <memory>
-#include <queue>
+#include <deque>
+#include <functional>
 #include <random>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 #include <boost/bind.hpp>
 #include <boost/asio.hpp>
 #include <boost/asio/ssl.hpp>
@@ -32,19 +37,140 @@
 
 #ifdef WIN32
 #include "w32crypt_seed.hpp"
+#else
+#include <fcntl.h>
+#include <unistd.h>
 #endif
 
 namespace{
 
-	struct context{
-		virtual ~context(){}
+	/* every connection shares one io_service, run from the main loop
+	 * through connection::poll(); the work object keeps poll() from
+	 * stopping it whenever no connection is active
+	 */
+	boost::asio::io_service & shared_io_service()
+	{
+		static boost::asio::io_service io_service;
+		static boost::asio::io_service::work work(io_service);
+		return io_service;
+	}
+
+	/* Name lookups run on a few threads of their own: asio gives each
+	 * io_service a single private resolver thread, which would serialize
+	 * the lookups of a bulk reconnect. Results are posted back to the
+	 * shared io_service. The pool is created after the shared io_service,
+	 * so it is destroyed first, and it joins its threads on the way out;
+	 * nothing posts to the shared io_service once that is gone. Outside
+	 * Win32 every result also makes a pipe readable, so the main loop
+	 * can sleep on that instead of polling while a lookup runs.
+	 */
+	class lookup_pool
+	{
+	public:
+		typedef std::function<void(const boost::system::error_code&, boost::asio::ip::tcp::resolver::iterator)> handler;
+
+		static lookup_pool & get()
+		{
+			static lookup_pool pool;
+			return pool;
+		}
+
+		void resolve(const std::string & host, unsigned short port, handler done)
+		{
+			service_.post([this, host, port, done]()
+			{
+				boost::asio::ip::tcp::resolver resolver(service_);
+				boost::asio::ip::tcp::resolver::query query(host, std::to_string(port));
+				boost::system::error_code error;
+				auto endpoint_iterator = resolver.resolve(query, error);
+				shared_io_service().post(std::bind(done, error, endpoint_iterator));
+#ifndef WIN32
+				// a full pipe is readable already
+				const char wake = 0;
+				ssize_t ignored = ::write(wake_[1], &wake, 1);
+				(void)ignored;
+#endif
+			});
+		}
 
-		boost::asio::io_service io_service;
+		int wake_handle() const
+		{
+			return wake_[0];
+		}
+
+		/* empties the pipe, before poll() runs whatever woke it */
+		void drain()
+		{
+#ifndef WIN32
+			char buf[64];
+			while (::read(wake_[0], buf, sizeof(buf)) > 0)
+				;
+#endif
+		}
+
+	private:
+		/* concurrent lookups; more wait their turn */
+		static const int threads = 4;
+
+		lookup_pool()
+			:work_(new boost::asio::io_service::work(service_))
+		{
+			shared_io_service();
+			wake_[0] = wake_[1] = -1;
+#ifndef WIN32
+			if (::pipe(wake_) == 0)
+			{
+				for (auto fd : wake_)
+				{
+					::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+					::fcntl(fd, F_SETFD, FD_CLOEXEC);
+				}
+			}
+			else
+				wake_[0] = wake_[1] = -1;
+#endif
+			for (int i = 0; i < threads; ++i)
+				threads_.emplace_back([this]() { service_.run(); });
+		}
+
+		~lookup_pool()
+		{
+			/* lookups not started yet are dropped; one stuck in the
+			 * system resolver is waited for */
+			work_.reset();
+			service_.stop();
+			for (auto & thread : threads_)
+				thread.join();
+#ifndef WIN32
+			for (auto fd : wake_)
+				if (fd != -1)
+					::close(fd);
+#endif
+		}
+
+		lookup_pool(const lookup_pool&) = delete;
+		lookup_pool& operator=(const lookup_pool&) = delete;
+
+		boost::asio::io_service service_;
+		std::unique_ptr<boost::asio::io_service::work> work_;
+		std::vector<std::thread> threads_;
+		int wake_[2];
 	};
 
-	struct ssl_context : public context{
-		ssl_context(boost::asio::ssl::context::verify_mode mode)
-			:ssl_ctx(io_service, boost::asio::ssl::context::tlsv1)
+	/* how long a connect attempt gets before the next endpoint joins the race */
+	const int attempt_delay_ms = 250;
+
+	/* free space every read is given at the end of the read buffer */
+	const std::size_t read_chunk_size = 16384;
+	/* a partial line this long is garbage, not IRC; drop it */
+	const std::size_t max_line_length = 65536;
+	/* queued lines are sent together in one write of at most this many
+	 * bytes (but always at least one line), a full TLS record */
+	const std::size_t write_budget = 16384;
+
+	struct ssl_context{
+		explicit ssl_context(boost::asio::ssl::context::verify_mode mode)
+			:ssl_ctx(shared_io_service(), boost::asio::ssl::context::tlsv1)
 		{
 			ssl_ctx.set_options(
 				boost::asio::ssl::context::no_sslv2 |
@@ -53,105 +179,367 @@ namespace{
 				boost::asio::ssl::context::single_dh_use |
 				SSL_OP_CIPHER_SERVER_PREFERENCE);
 			ssl_ctx.set_verify_mode(mode);
+			SSL_CTX_set_session_cache_mode(ssl_ctx.native_handle(), SSL_SESS_CACHE_CLIENT);
+		}
+
+		~ssl_context()
+		{
+			for (auto & session : sessions)
+				SSL_SESSION_free(session.second);
+		}
+
+		/* remember the session a handshake with host:port established so
+		 * the next connection there resumes it instead of doing a full
+		 * handshake
+		 */
+		void save_session(const std::string & key, SSL * ssl)
+		{
+			SSL_SESSION * session = SSL_get1_session(ssl);
+			if (!session)
+				return;
+			auto res = sessions.insert(std::make_pair(key, session));
+			if (!res.second)
+			{
+				SSL_SESSION_free(res.first->second);
+				res.first->second = session;
+			}
+		}
+
+		SSL_SESSION * find_session(const std::string & key) const
+		{
+			auto res = sessions.find(key);
+			if (res == sessions.cend())
+				return nullptr;
+			return res->second;
 		}
+
 		boost::asio::ssl::context ssl_ctx;
+		std::unordered_map<std::string, SSL_SESSION*> sessions;
+	};
+
+	/* one context per verify mode, kept for the life of the process so
+	 * the session cache survives a netsplit and the reconnects after it
+	 */
+	std::shared_ptr<ssl_context> acquire_ssl_context(boost::asio::ssl::context::verify_mode mode)
+	{
+		static std::map<boost::asio::ssl::context::verify_mode, std::shared_ptr<ssl_context> > pool;
+		auto & ctx = pool[mode];
+		if (!ctx)
+			ctx = std::make_shared<ssl_context>(mode);
+		return ctx;
+	}
+
+	/* RFC 6555: alternate address families, starting with the one the
+	 * resolver preferred, so a broken family costs at most one attempt
+	 * delay before the other is tried
+	 */
+	std::vector<boost::asio::ip::tcp::endpoint>
+	interleave_families(boost::asio::ip::tcp::resolver::iterator endpoint_iterator)
+	{
+		std::vector<boost::asio::ip::tcp::endpoint> preferred;
+		std::vector<boost::asio::ip::tcp::endpoint> other;
+		const boost::asio::ip::tcp::resolver::iterator end;
+		const bool preferred_v6 = endpoint_iterator != end && endpoint_iterator->endpoint().address().is_v6();
+		for (; endpoint_iterator != end; ++endpoint_iterator)
+		{
+			const auto endpoint = endpoint_iterator->endpoint();
+			if (endpoint.address().is_v6() == preferred_v6)
+				preferred.push_back(endpoint);
+			else
+				other.push_back(endpoint);
+		}
+
+		std::vector<boost::asio::ip::tcp::endpoint> result;
+		result.reserve(preferred.size() + other.size());
+		for (std::size_t i = 0; i < std::max(preferred.size(), other.size()); ++i)
+		{
+			if (i < preferred.size())
+				result.push_back(preferred[i]);
+			if (i < other.size())
+				result.push_back(other[i]);
+		}
+		return result;
+	}
+
+	/* The socket side of a connection. Pending handlers hold a shared_ptr
+	 * to it, so it outlives the io::tcp::connection that owns it until the
+	 * shared io_service has run them; close() detaches it from the owner
+	 * so those late handlers don't signal anyone.
+	 */
+	struct connection_impl
+	{
+		virtual ~connection_impl(){}
+		virtual void connect(const std::string & host, unsigned short port) = 0;
+		virtual void enqueue_message(const std::string & message) = 0;
+		virtual bool connected() const = 0;
+		virtual boost::asio::ip::tcp::socket::native_handle_type native_handle() = 0;
+		virtual bool wants_write() const = 0;
+		virtual bool resolving() const = 0;
+		virtual void close() = 0;
+	};
+
+	struct connection_handle : public io::tcp::connection
+	{
+		~connection_handle()
+		{
+			if (impl_)
+				impl_->close();
+		}
+
+		void enqueue_message(const std::string & message)
+		{
+			impl_->enqueue_message(message);
+		}
+
+		void connect(const std::string & host, unsigned short port)
+		{
+			impl_->connect(host, port);
+		}
+
+		bool connected() const
+		{
+			return impl_->connected();
+		}
+
+		boost::asio::ip::tcp::socket::native_handle_type native_handle()
+		{
+			return impl_->native_handle();
+		}
+
+		bool wants_write() const
+		{
+			return impl_->wants_write();
+		}
+
+		bool resolving() const
+		{
+			return impl_->resolving();
+		}
+
+		void poll()
+		{
+			lookup_pool::get().drain();
+			shared_io_service().poll();
+		}
+
+		std::shared_ptr<connection_impl> impl_;
 	};
 
 	template<class SocketType_>
-	struct basic_connection : public io::tcp::connection
+	struct basic_connection : public connection_impl, public std::enable_shared_from_this<basic_connection<SocketType_> >
 	{
+		typedef std::shared_ptr<boost::asio::ip::tcp::socket> attempt_ptr;
+
 		virtual ~basic_connection(){}
 		template<class... Types_>
-		basic_connection(context * ctx, Types_&& ... args)
-			:ctx_(ctx), message_(4096, '\0'), socket_(ctx_->io_service, std::forward<Types_>(args)...), strand_(ctx_->io_service)
+		basic_connection(io::tcp::connection & owner, Types_&& ... args)
+			:owner_(&owner), read_end_(0), socket_(shared_io_service(), std::forward<Types_>(args)...), strand_(shared_io_service()),
+			attempt_timer_(shared_io_service()), port_(0), next_endpoint_(0),
+			in_flight_(0), connecting_(false), resolving_(false)
 		{
-			input_buffer_.commit(4092);
 		}
 
-		basic_connection(){};
-
 		bool connected() const
 		{
 			return socket_.lowest_layer().is_open();
 		}
 
-		void connect(boost::asio::ip::tcp::resolver::iterator endpoint_iterator)
+		boost::asio::ip::tcp::socket::native_handle_type native_handle()
 		{
-			boost::asio::ip::tcp::resolver::iterator current_iterator = endpoint_iterator;
-			boost::asio::ip::tcp::endpoint endpoint = *endpoint_iterator;
-			socket_.lowest_layer().async_connect(endpoint,
-				boost::bind(&basic_connection::do_connect, this,
-				boost::asio::placeholders::error, ++endpoint_iterator, current_iterator));
+			return socket_.lowest_layer().native_handle();
+		}
+
+		bool wants_write() const
+		{
+			return !outbound_queue_.empty();
+		}
+
+		bool resolving() const
+		{
+			return resolving_;
+		}
+
+		void close()
+		{
+			boost::system::error_code ignored;
+			owner_ = nullptr;
+			connecting_ = false;
+			resolving_ = false;
+			attempt_timer_.cancel(ignored);
+			for (auto & attempt : attempts_)
+				attempt->close(ignored);
+			attempts_.clear();
+			socket_.lowest_layer().close(ignored);
+		}
+
+		void connect(const std::string & host, unsigned short port)
+		{
+			connecting_ = true;
+			resolving_ = true;
+			host_ = host;
+			port_ = port;
+			lookup_pool::get().resolve(host, port,
+				std::bind(&basic_connection::handle_resolve, this->shared_from_this(),
+				std::placeholders::_1, std::placeholders::_2));
 		}
 		void enqueue_message(const std::string & message);
-		/* Gets around the thorny issue of calling or referencing a
-		 * virtual function from the constructor
+		void handle_resolve(const boost::system::error_code& error,
+			boost::asio::ip::tcp::resolver::iterator endpoint_iterator)
+		{
+			// closed while the lookup was running
+			if (!connecting_)
+				return;
+			resolving_ = false;
+			if (error)
+			{
+				connecting_ = false;
+				this->handle_error(error);
+				return;
+			}
+			endpoints_ = interleave_families(endpoint_iterator);
+			next_endpoint_ = 0;
+			this->start_attempt();
+		}
+		/* Happy eyeballs (RFC 6555): each attempt gets its own socket and
+		 * the next endpoint is tried as soon as one fails or the delay
+		 * runs out, whichever comes first. The first to connect wins
+		 * and is moved into socket_.
 		 */
-		void do_connect(const boost::system::error_code& error,
-			boost::asio::ip::tcp::resolver::iterator endpoint_iterator,
-			boost::asio::ip::tcp::resolver::iterator current_endpoint){
-			if (error && endpoint_iterator != boost::asio::ip::tcp::resolver::iterator())
+		void start_attempt()
+		{
+			const boost::asio::ip::tcp::endpoint endpoint = endpoints_[next_endpoint_++];
+			attempt_ptr attempt = std::make_shared<boost::asio::ip::tcp::socket>(shared_io_service());
+			attempts_.push_back(attempt);
+			if (owner_)
+				owner_->on_connecting(endpoint);
+			attempt->async_connect(endpoint,
+				boost::bind(&basic_connection::handle_attempt, this->shared_from_this(),
+				boost::asio::placeholders::error, attempt, endpoint));
+			if (next_endpoint_ < endpoints_.size())
 			{
-				socket_.lowest_layer().close();
-				boost::asio::ip::tcp::resolver::iterator current_iterator = endpoint_iterator;
-				boost::asio::ip::tcp::endpoint endpoint = *endpoint_iterator;
-				socket_.lowest_layer().async_connect(endpoint,
-					boost::bind(&basic_connection::do_connect, this,
-					boost::asio::placeholders::error, ++endpoint_iterator, current_iterator));
+				attempt_timer_.expires_from_now(boost::posix_time::milliseconds(attempt_delay_ms));
+				attempt_timer_.async_wait(
+					boost::bind(&basic_connection::handle_attempt_timer, this->shared_from_this(),
+					boost::asio::placeholders::error));
 			}
-			else if (error)
+		}
+		void handle_attempt_timer(const boost::system::error_code& error)
+		{
+			if (error || !connecting_ || next_endpoint_ >= endpoints_.size())
+				return;
+			this->start_attempt();
+		}
+		/* Gets around the thorny issue of calling or referencing a
+		 * virtual function from the constructor
+		 */
+		void handle_attempt(const boost::system::error_code& error,
+			attempt_ptr attempt,
+			const boost::asio::ip::tcp::endpoint& endpoint)
+		{
+			attempts_.erase(std::remove(attempts_.begin(), attempts_.end(), attempt), attempts_.end());
+			// another attempt already won, this one was cancelled
+			if (!connecting_)
+				return;
+			if (error)
 			{
-				this->handle_error(error);
+				if (next_endpoint_ < endpoints_.size())
+				{
+					attempt_timer_.cancel();
+					this->start_attempt();
+				}
+				else if (attempts_.empty())
+				{
+					connecting_ = false;
+					this->handle_error(error);
+				}
+				return;
 			}
-			else
+
+			connecting_ = false;
+			attempt_timer_.cancel();
+			for (auto & loser : attempts_)
 			{
-				boost::asio::ip::tcp::no_delay no_delay(true);
-				this->socket_.lowest_layer().set_option(no_delay);
-				boost::asio::socket_base::non_blocking_io non_blocking(true);
-				this->socket_.lowest_layer().io_control(non_blocking);
-				boost::asio::socket_base::keep_alive option(true);
-				this->socket_.lowest_layer().set_option(option);
-				this->on_valid_connection(current_endpoint->host_name());
-				this->handle_connect(error, current_endpoint);
+				boost::system::error_code ignored;
+				loser->close(ignored);
 			}
+			attempts_.clear();
+			endpoints_.clear();
+
+			this->socket_.lowest_layer() = std::move(*attempt);
+			boost::asio::ip::tcp::no_delay no_delay(true);
+			this->socket_.lowest_layer().set_option(no_delay);
+			boost::asio::socket_base::non_blocking_io non_blocking(true);
+			this->socket_.lowest_layer().io_control(non_blocking);
+			boost::asio::socket_base::keep_alive option(true);
+			this->socket_.lowest_layer().set_option(option);
+			this->connected_endpoint_ = endpoint;
+			if (owner_)
+				owner_->on_valid_connection(host_);
+			this->handle_connect(error, endpoint);
 		}
 		virtual void handle_connect(const boost::system::error_code& error,
-			boost::asio::ip::tcp::resolver::iterator endpoint_iterator) = 0;
+			const boost::asio::ip::tcp::endpoint& endpoint) = 0;
+		void start_read();
 		void handle_read(const boost::system::error_code& error,
 			size_t bytes_transferred);
 		void handle_write(const boost::system::error_code& error,
 			size_t bytes_transferred);
 		void handle_error(const boost::system::error_code& error);
-		void poll()
-		{
-			this->ctx_->io_service.poll();
-		}
+		/* asio's SSL stream encrypts only the first buffer of a sequence
+		 * per write_some, which would cost a TLS record per line, so it
+		 * asks for each batch as one contiguous buffer instead */
+		virtual bool contiguous_writes() const { return false; }
 		void write_impl(const std::string& message);
 		void write();
 
-		std::unique_ptr<context> ctx_;
-		std::string message_;
-		boost::asio::streambuf input_buffer_;
-		std::queue<std::string> outbound_queue_;
+		io::tcp::connection * owner_;
+		/* [0, read_end_) holds at most one partial line once
+		 * handle_read has framed everything complete */
+		std::vector<char> read_buffer_;
+		std::size_t read_end_;
+		/* the first in_flight_ lines are being written; a deque so lines
+		 * queued meanwhile don't move the ones write_buffers_ points at */
+		std::deque<std::string> outbound_queue_;
+		std::vector<boost::asio::const_buffer> write_buffers_;
+		std::string write_batch_;
 		SocketType_ socket_;
 		boost::asio::strand strand_;
 		boost::asio::ip::tcp::endpoint connected_endpoint_;
+		boost::asio::deadline_timer attempt_timer_;
+		std::string host_;
+		unsigned short port_;
+		std::vector<boost::asio::ip::tcp::endpoint> endpoints_;
+		std::vector<attempt_ptr> attempts_;
+		std::size_t next_endpoint_;
+		std::size_t in_flight_;
+		bool connecting_;
+		bool resolving_;
 	};
 
 	struct ssl_connection : public basic_connection < boost::asio::ssl::stream<boost::asio::ip::tcp::socket> >
 	{
-		ssl_connection(ssl_context * ctx)
-			:basic_connection(ctx, ctx->ssl_ctx)
+		ssl_connection(io::tcp::connection & owner, const std::shared_ptr<ssl_context> & ctx)
+			:basic_connection(owner, ctx->ssl_ctx), ctx_(ctx)
+		{
+		}
+
+		std::string session_key() const
 		{
+			return host_ + ":" + std::to_string(port_);
 		}
 
 		void handle_connect(const boost::system::error_code& error,
-			boost::asio::ip::tcp::resolver::iterator endpoint_iterator)
+			const boost::asio::ip::tcp::endpoint& endpoint)
 		{
 			if (!error)
 			{
+				// offer the last session with this server for resumption
+				SSL_SESSION * session = ctx_->find_session(session_key());
+				if (session)
+					SSL_set_session(socket_.impl()->ssl, session);
 				socket_.async_handshake(boost::asio::ssl::stream_base::client,
-					boost::bind(&ssl_connection::handle_handshake, this,
+					boost::bind(&ssl_connection::handle_handshake,
+					std::static_pointer_cast<ssl_connection>(this->shared_from_this()),
 					boost::asio::placeholders::error));
 			}
 			else
@@ -163,46 +551,50 @@ namespace{
 
 		void handle_handshake(const boost::system::error_code& error)
 		{
+			if (!owner_)
+				return;
 			if (!error)
 			{
-				// start the read loop
-				boost::asio::async_read_until(socket_, this->input_buffer_, "\r\n",
-					boost::bind(&basic_connection::handle_read, this,
-					boost::asio::placeholders::error,
-					boost::asio::placeholders::bytes_transferred));
+				ctx_->save_session(session_key(), socket_.impl()->ssl);
+				this->start_read();
 
 				// callback to allow for printing of cipher info
-				this->on_ssl_handshakecomplete(socket_.impl()->ssl);
-				this->on_connect(error);
+				owner_->on_ssl_handshakecomplete(socket_.impl()->ssl);
+				if (owner_)
+					owner_->on_connect(error);
 			}
 			else
 			{
 				this->handle_error(error);
 			}
 		}
+
+		bool contiguous_writes() const
+		{
+			return true;
+		}
+
+		std::shared_ptr<ssl_context> ctx_;
 	};
 
 	struct tcp_connection : public basic_connection < boost::asio::ip::tcp::socket >
 	{
-		tcp_connection(context * ctx)
-			:basic_connection(ctx)
+		explicit tcp_connection(io::tcp::connection & owner)
+			:basic_connection(owner)
 		{
 		}
 
 		void handle_connect(const boost::system::error_code& error,
-			boost::asio::ip::tcp::resolver::iterator endpoint_iterator)
+			const boost::asio::ip::tcp::endpoint& endpoint)
 		{
 			if (error)
 			{
 				this->handle_error(error);
 				return;
 			}
-			// start the read loop
-			boost::asio::async_read_until(socket_, this->input_buffer_, "\r\n",
-				boost::bind(&basic_connection::handle_read, this,
-				boost::asio::placeholders::error,
-				boost::asio::placeholders::bytes_transferred));
-			this->on_connect(error);
+			this->start_read();
+			if (owner_)
+				owner_->on_connect(error);
 		}
 	};
 
@@ -210,21 +602,47 @@ namespace{
 	void
 	basic_connection<SocketType_>::write_impl(const std::string & message)
 	{
-		this->outbound_queue_.push(message);
-		// return if we have a pending write
-		if (this->outbound_queue_.size() > 1)
+		this->outbound_queue_.push_back(message);
+		// return if we have a pending write, it picks this up when done
+		if (this->in_flight_)
 			return;
 		this->write();
 	}
 
+	/* gathers as many queued lines as fit in the budget into one write */
 	template<class SocketType_>
 	void
 	basic_connection<SocketType_>::write()
 	{
-		const std::string& message = this->outbound_queue_.front();
+		std::size_t bytes = 0;
+		this->in_flight_ = 0;
+		for (const auto & message : this->outbound_queue_)
+		{
+			if (this->in_flight_ && bytes + message.size() > write_budget)
+				break;
+			bytes += message.size();
+			++this->in_flight_;
+		}
+
+		const auto batch_end = this->outbound_queue_.cbegin() + this->in_flight_;
+		this->write_buffers_.clear();
+		if (this->in_flight_ > 1 && this->contiguous_writes())
+		{
+			this->write_batch_.clear();
+			this->write_batch_.reserve(bytes);
+			for (auto it = this->outbound_queue_.cbegin(); it != batch_end; ++it)
+				this->write_batch_.append(*it);
+			this->write_buffers_.push_back(boost::asio::buffer(this->write_batch_));
+		}
+		else
+		{
+			for (auto it = this->outbound_queue_.cbegin(); it != batch_end; ++it)
+				this->write_buffers_.push_back(boost::asio::buffer(*it));
+		}
+
 		boost::asio::async_write(socket_,
-			boost::asio::buffer(message),
-			boost::bind(&basic_connection::handle_write, this,
+			this->write_buffers_,
+			boost::bind(&basic_connection::handle_write, this->shared_from_this(),
 			boost::asio::placeholders::error,
 			boost::asio::placeholders::bytes_transferred));
 	}
@@ -233,7 +651,7 @@ namespace{
 	void
 	basic_connection<SocketType_>::enqueue_message(const std::string & message)
 	{
-		this->strand_.post(std::bind(std::mem_fn(&basic_connection::write_impl), this, message));
+		this->strand_.post(std::bind(std::mem_fn(&basic_connection::write_impl), this->shared_from_this(), message));
 	}
 
 	template<class SocketType_>
@@ -241,40 +659,79 @@ namespace{
 	basic_connection<SocketType_>::handle_write(const boost::system::error_code& error,
 		size_t bytes_transferred)
 	{
+		if (!this->owner_)
+			return;
 		if (error)
 		{
 			this->handle_error(error);
 			// TODO: print error to session
 			return;
 		}
-		this->outbound_queue_.pop();
+		this->outbound_queue_.erase(this->outbound_queue_.begin(), this->outbound_queue_.begin() + this->in_flight_);
+		this->in_flight_ = 0;
 		if (!this->outbound_queue_.empty()){
 			this->write();
 		}
 	   
 	}
 
+	template<class SocketType_>
+	void
+	basic_connection<SocketType_>::start_read()
+	{
+		if (this->read_buffer_.size() - this->read_end_ < read_chunk_size)
+			this->read_buffer_.resize(this->read_end_ + read_chunk_size);
+		socket_.async_read_some(
+			boost::asio::buffer(&this->read_buffer_[this->read_end_], this->read_buffer_.size() - this->read_end_),
+			boost::bind(&basic_connection::handle_read, this->shared_from_this(),
+			boost::asio::placeholders::error,
+			boost::asio::placeholders::bytes_transferred));
+	}
+
+	/* Frames lines in place: every complete line is handed out as a view
+	 * into the read buffer, and only the trailing partial line, if any,
+	 * is moved to the front for the next read to append to.
+	 */
 	template<class SocketType_>
 	void
 	basic_connection<SocketType_>::handle_read(const boost::system::error_code& error,
 		size_t bytes_transferred)
 	{
-		if (!error)
-		{
-			std::istream stream(&input_buffer_);
-			size_t to_read = std::min(message_.size(), bytes_transferred);
-			stream.read(&message_[0], to_read);
-			this->on_message(message_, to_read);
-			
-			boost::asio::async_read_until(socket_, this->input_buffer_, "\r\n",
-				boost::bind(&basic_connection::handle_read, this,
-				boost::asio::placeholders::error,
-				boost::asio::placeholders::bytes_transferred));
-		}
-		else
+		if (!this->owner_)
+			return;
+		if (error)
 		{
 			this->handle_error(error);
+			return;
 		}
+
+		const char * const begin = this->read_buffer_.data();
+		const char * const end = begin + this->read_end_ + bytes_transferred;
+		// whatever was here before this read had no '\n' in it
+		const char * scan = begin + this->read_end_;
+		const char * line = begin;
+		const char * eol;
+		while ((eol = static_cast<const char*>(std::memchr(scan, '\n', end - scan))) != nullptr)
+		{
+			const char * line_end = eol;
+			if (line_end != line && line_end[-1] == '\r')
+				--line_end;
+			if (line_end != line)
+			{
+				this->owner_->on_message(boost::string_ref(line, line_end - line));
+				// the owner may have closed us from its handler
+				if (!this->owner_)
+					return;
+			}
+			line = scan = eol + 1;
+		}
+
+		this->read_end_ = end - line;
+		if (this->read_end_ >= max_line_length)
+			this->read_end_ = 0;
+		else if (line != begin && this->read_end_)
+			std::memmove(&this->read_buffer_[0], line, this->read_end_);
+		this->start_read();
 	}
 
 	template<class SocketType_>
@@ -298,7 +755,8 @@ namespace{
 		default:
 			break;
 		}*/
-		this->on_error(error);
+		if (this->owner_)
+			this->owner_->on_error(error);
 	}
 	
 }
@@ -306,27 +764,27 @@ namespace{
 namespace io{
 	namespace tcp{
 
-		std::pair<boost::system::error_code, boost::asio::ip::tcp::resolver::iterator> resolve_endpoints(boost::asio::io_service& io_service, const std::string & host, unsigned short port)
-		{
-			boost::asio::ip::tcp::resolver::query query(host, std::to_string(port));
-			boost::asio::ip::tcp::resolver res(io_service);
-			boost::system::error_code ec;
-			auto result = res.resolve(query, ec);
-			return std::make_pair(ec, result);
-		}
-
 		std::unique_ptr<connection>
-			connection::create_connection(connection_security security, boost::asio::io_service& io_service)
+			connection::create_connection(connection_security security)
 		{
+			std::unique_ptr<connection_handle> handle = sutter::make_unique<connection_handle>();
 			if (security == connection_security::enforced || security == connection_security::no_verify)
 			{
 #ifdef WIN32
 				w32::crypto::seed_openssl_random();
 #endif
-				return sutter::make_unique<ssl_connection>(new ssl_context(security == connection_security::enforced ? boost::asio::ssl::verify_peer : boost::asio::ssl::verify_none));
+				handle->impl_ = std::make_shared<ssl_connection>(*handle, acquire_ssl_context(security == connection_security::enforced ? boost::asio::ssl::verify_peer : boost::asio::ssl::verify_none));
+			}
+			else
+			{
+				handle->impl_ = std::make_shared<tcp_connection>(*handle);
 			}
-			return sutter::make_unique<tcp_connection>(new context());
+			return std::move(handle);
 		}
-	}
-}
 
+		int connection::wake_handle()
+		{
+			return lookup_pool::get().wake_handle();
+		}
+	}
+}
\ No newline at end of file
@@ -25,6 +25,7 @@
 #include <utility>
 #include <boost/asio.hpp>
 #include <boost/signals2.hpp>
+#include <boost/utility/string_ref.hpp>
 #include <openssl/ssl.h>
 #include "tcpfwd.hpp"
 
@@ -33,20 +34,36 @@ namespace io
 	namespace tcp{
 		class connection{
 		public:
-			static std::unique_ptr<connection> create_connection(connection_security security, boost::asio::io_service& io_service);
+			/* connections share one process-wide io_service, which poll()
+			 * runs, and one SSL context per verify mode */
+			static std::unique_ptr<connection> create_connection(connection_security security);
 			virtual void enqueue_message(const std::string & message) = 0;
-			virtual void connect(boost::asio::ip::tcp::resolver::iterator endpoint_iterator) = 0;
+			/* resolves host asynchronously, then races the resulting
+			 * endpoints, alternating address families */
+			virtual void connect(const std::string & host, unsigned short port) = 0;
 			virtual bool connected() const = 0;
+			/* the socket the main loop should watch to know when poll()
+			 * has something to do, invalid until connected */
+			virtual boost::asio::ip::tcp::socket::native_handle_type native_handle() = 0;
+			/* true while queued output waits on the socket becoming
+			 * writable */
+			virtual bool wants_write() const = 0;
+			/* true until the lookup connect() started has finished; while
+			 * it is, poll() only has work once wake_handle() is readable */
+			virtual bool resolving() const = 0;
+			/* readable whenever a lookup has finished, -1 on Win32 */
+			static int wake_handle();
 			virtual void poll() = 0;
 			virtual ~connection(){}
+			boost::signals2::signal<void(const boost::asio::ip::tcp::endpoint&)> on_connecting;
 			boost::signals2::signal<void(const boost::system::error_code&)> on_connect;
 			boost::signals2::signal<void(const std::string& hostname)> on_valid_connection;
 			boost::signals2::signal<void(const boost::system::error_code&)> on_error;
-			boost::signals2::signal<void(const std::string & message, size_t length)> on_message;
+			/* one line without its CR LF, pointing into the read buffer,
+			 * so it is only valid during the call */
+			boost::signals2::signal<void(const boost::string_ref & line)> on_message;
 			boost::signals2::signal<void(const SSL*)> on_ssl_handshakecomplete;
 		};
-
-		std::pair<boost::system::error_code, boost::asio::ip::tcp::resolver::iterator> resolve_endpoints(boost::asio::io_service& io_service, const std::string & host, unsigned short port);
 	}
 }
 #endif
\ No newline at end of file
@@ -16,83 +16,143 @@
 * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
 */
 
-#include <chrono>
-#include <queue>
-#include <boost/algorithm/string.hpp>
+#include <algorithm>
+#include <array>
+#include <deque>
+#include <boost/utility/string_ref.hpp>
 #include "throttled_queue.hpp"
-#include "tcp_connection.hpp"
 #include "sutter.hpp"
 
+namespace
+{
+	/* how far ahead of now the send time may run before we hold back */
+	const std::chrono::seconds burst_allowance(10);
+
+	enum priority
+	{
+		priority_low,		/* WHO and MODE queries */
+		priority_message,	/* PRIVMSG and NOTICE */
+		priority_normal,	/* everything else */
+		priority_count
+	};
+
+	bool ascii_iequals(const boost::string_ref & lhs, const boost::string_ref & rhs)
+	{
+		return lhs.size() == rhs.size() && std::equal(lhs.cbegin(), lhs.cend(), rhs.cbegin(),
+			[](char a, char b)
+			{
+				return (a >= 'A' && a <= 'Z' ? a + ('a' - 'A') : a) == (b >= 'A' && b <= 'Z' ? b + ('a' - 'A') : b);
+			});
+	}
+
+	priority classify(const boost::string_ref & outbound)
+	{
+		boost::string_ref command = outbound;
+		if (command.starts_with(':'))
+		{
+			auto space = command.find(' ');
+			if (space == boost::string_ref::npos)
+				return priority_normal;
+			command.remove_prefix(space + 1);
+		}
+		command = command.substr(0, command.find(' '));
+
+		/* privmsg and notice get a lower priority */
+		if (ascii_iequals(command, "PRIVMSG") || ascii_iequals(command, "NOTICE"))
+			return priority_message;
+		/* WHO/MODE get the lowest priority */
+		if (ascii_iequals(command, "WHO"))
+			return priority_low;
+		/* but only MODE queries, not changes */
+		if (ascii_iequals(command, "MODE") && outbound.find_first_of("+-") == boost::string_ref::npos)
+			return priority_low;
+		return priority_normal;
+	}
+
+	std::chrono::seconds penalty(const boost::string_ref & outbound)
+	{
+		auto space = outbound.find(' ');
+		auto params = space == boost::string_ref::npos ? 0 : outbound.size() - space;
+		return std::chrono::seconds(2 + params / 120);
+	}
+
+	struct queued_line
+	{
+		std::string line;
+		io::irc::throttled_queue::clock::duration penalty;
+	};
+}
+
 namespace io
 {
 	namespace irc
 	{
 		class throttled_queue::p_impl
 		{
-			std::priority_queue<std::pair<int, std::string> > outbound_queue;
+			std::array<std::deque<queued_line>, priority_count> queues;
 			size_type queue_len_in_bytes;
-			std::chrono::system_clock::time_point next_send;
-			std::chrono::system_clock::time_point prev_now;
-		public:
-			p_impl()
-				:queue_len_in_bytes(0)
-			{}
-
-			~p_impl(){}
+			size_type queue_len_in_lines;
+			clock::duration queued_penalty;
+			clock::time_point next_send;	/* cptr->since in ircu */
 
-			void push(const std::string & inbound)
+			/* try priority 2,1,0 */
+			int front_priority() const
 			{
-				int priority = 2;	/* pri 2 for most things */
-				/* privmsg and notice get a lower priority */
-				if (boost::icontains(inbound, "PRIVMSG") ||
-					boost::icontains(inbound, "NOTICE"))
-				{
-					priority = 1;
-				}
-				else
+				for (int pri = priority_count - 1; pri >= 0; --pri)
 				{
-					/* WHO/MODE get the lowest priority */
-					if (boost::icontains(inbound, "WHO") ||
-						/* but only MODE queries, not changes */
-						(boost::icontains(inbound, "MODE") &&
-						inbound.find_first_of('-') == std::string::npos &&
-						inbound.find_first_of('+') == std::string::npos))
-						priority = 0;
+					if (!this->queues[pri].empty())
+						return pri;
 				}
+				return -1;
+			}
+		public:
+			p_impl()
+				:queue_len_in_bytes(0), queue_len_in_lines(0), queued_penalty(clock::duration::zero())
+			{}
 
-				this->outbound_queue.emplace(std::make_pair(priority, inbound));
-				this->queue_len_in_bytes += inbound.size(); /* tcp_send_queue uses strlen */
+			void push(const boost::string_ref & outbound)
+			{
+				queued_line entry = { outbound.to_string(), penalty(outbound) };
+				this->queue_len_in_bytes += outbound.size();
+				++this->queue_len_in_lines;
+				this->queued_penalty += entry.penalty;
+				this->queues[classify(outbound)].push_back(std::move(entry));
 			}
 
-			boost::optional<std::string> front()
+			boost::optional<const std::string &> front() const
 			{
-				/* try priority 2,1,0 */
-				auto now = std::chrono::system_clock::now();
+				auto pri = this->front_priority();
+				if (pri < 0)
+					return boost::none;
 
-				/* did the server close since the timeout was added? */
-				if (this->outbound_queue.empty())
+				auto now = clock::now();
+				if (std::max(this->next_send, now) - now >= burst_allowance)
 					return boost::none;
+				return boost::optional<const std::string &>(this->queues[pri].front().line);
+			}
 
-				auto & top = this->outbound_queue.top();
+			void pop()
+			{
+				auto pri = this->front_priority();
+				if (pri < 0)
+					return;
+
+				auto & queue = this->queues[pri];
+				auto & top = queue.front();
+				this->next_send = std::max(this->next_send, clock::now()) + top.penalty;
+				this->queue_len_in_bytes -= top.line.size();
+				--this->queue_len_in_lines;
+				this->queued_penalty -= top.penalty;
+				queue.pop_front();
+			}
 
-				if (this->next_send < now)
-					this->next_send = now;
-				if (this->next_send - now >= std::chrono::seconds(10))
-				{
-					/* check for clock skew */
-					if (now >= this->prev_now)
-						return boost::none;		  /* don't remove the timeout handler */
-					/* it is skewed, reset to something sane */
-					this->next_send = now;
-				}
-				std::string::size_type i;
-				const char* p;
-				for (p = top.second.c_str(), i = top.second.size(); i && *p != ' '; p++, i--);
-				this->next_send += std::chrono::seconds(2 + i / 120);
-				this->queue_len_in_bytes -= top.second.size();
-				this->prev_now = now;
-				
-				return top.second;
+			void clear()
+			{
+				for (auto & queue : this->queues)
+					queue.clear();
+				this->queue_len_in_bytes = 0;
+				this->queue_len_in_lines = 0;
+				this->queued_penalty = clock::duration::zero();
 			}
 
 			size_type queue_length() const
@@ -100,10 +160,18 @@ namespace io
 				return this->queue_len_in_bytes;
 			}
 
-			void clear()
+			size_type size() const
+			{
+				return this->queue_len_in_lines;
+			}
+
+			clock::duration time_to_drain() const
 			{
-				decltype(this->outbound_queue) empty;
-				std::swap(this->outbound_queue, empty);
+				if (!this->queue_len_in_lines)
+					return clock::duration::zero();
+				auto now = clock::now();
+				auto drained = std::max(this->next_send, now) + this->queued_penalty - burst_allowance;
+				return drained > now ? drained - now : clock::duration::zero();
 			}
 		};
 
@@ -112,19 +180,47 @@ namespace io
 			:impl(sutter::make_unique<throttled_queue::p_impl>())
 		{}
 
-		throttled_queue::size_type throttled_queue::queue_length() const
+		throttled_queue::~throttled_queue()
+		{}
+
+		void throttled_queue::push(const boost::string_ref & outbound)
 		{
-			return impl->queue_length();
+			impl->push(outbound);
 		}
 
-		void throttled_queue::push(const std::string & inbound)
+		boost::optional<const std::string &> throttled_queue::front() const
 		{
-			impl->push(inbound);
+			return impl->front();
+		}
+
+		void throttled_queue::pop()
+		{
+			impl->pop();
 		}
 
 		void throttled_queue::clear()
 		{
 			impl->clear();
 		}
+
+		bool throttled_queue::empty() const
+		{
+			return impl->size() == 0;
+		}
+
+		throttled_queue::size_type throttled_queue::queue_length() const
+		{
+			return impl->queue_length();
+		}
+
+		throttled_queue::size_type throttled_queue::size() const
+		{
+			return impl->size();
+		}
+
+		throttled_queue::clock::duration throttled_queue::time_to_drain() const
+		{
+			return impl->time_to_drain();
+		}
 	}
-}
\ No newline at end of file
+}
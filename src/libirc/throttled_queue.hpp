@@ -19,30 +19,49 @@
 #ifndef HEXCHAT_THROTTLED_QUEUE_HPP
 #define HEXCHAT_THROTTLED_QUEUE_HPP
 
+#include <chrono>
 #include <cstddef>
 #include <memory>
+#include <string>
 #include <boost/optional.hpp>
+#include <boost/utility/string_ref_fwd.hpp>
 #include "tcpfwd.hpp"
 
 namespace io
 {
 	namespace irc
 	{
+		/* Outbound flood protection, using the same penalty model as the
+		 * Undernet ircu2.10 server: each line sent adds 2 seconds plus one
+		 * per 120 bytes of parameters to the send time, and lines may go
+		 * out while that is less than 10 seconds ahead of now. Lines
+		 * queue FIFO within three priorities, and their priority and
+		 * penalty are worked out once, on push.
+		 */
 		class throttled_queue
 		{
 			class p_impl;
 			std::unique_ptr<p_impl> impl;
 		public:
 			typedef std::size_t size_type;
+			typedef std::chrono::steady_clock clock;
 			throttled_queue();
 			~throttled_queue();
 
-			void push(const std::string & inbound);
-			boost::optional<std::string> front();
+			void push(const boost::string_ref & outbound);
+			/* the next line to send, if the penalty lets it go now */
+			boost::optional<const std::string &> front() const;
+			/* removes the front line and charges its penalty */
 			void pop();
 			void clear();
+			bool empty() const;
 
+			/* queued bytes */
 			size_type queue_length() const;
+			/* queued lines */
+			size_type size() const;
+			/* how long until the last queued line may be sent */
+			clock::duration time_to_drain() const;
 		};
 	}
 }